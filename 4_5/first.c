@@ -25,7 +25,7 @@ enum EventType { MAP_EVENT, ACTION_EVENT, META_EVENT };
 
 // Структура, описывающая событие
 struct Event {
-    char timestamp[26];   // Временная метка
+    long long timestamp;  // Временная метка, нс
     char data[1024];      // Буфер данных
     enum EventType type;  // Тип события
 };
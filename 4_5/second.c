@@ -25,7 +25,7 @@ enum event_type { MAP, ACTION, META_INFO };
 
 // Описание события
 struct Event {
-    char timestamp[26];
+    long long timestamp;
     char buffer[1024];
     enum event_type type;
 };
@@ -33,7 +33,7 @@ struct FieldSize {
 enum event_type { MAP, ACTION, META_INFO };
 
 struct Event {
-    char timestamp[26];
+    long long timestamp;  // нс от запуска сервера (CLOCK_MONOTONIC)
     char buffer[1024];
     enum event_type type;
 };
@@ -156,12 +156,17 @@ void sprintField(char *buffer, int *field, int columns, int rows) {
     }
 }
 
+long long server_started_at;
+
+long long monotonicNanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Время события хранится числом, в текст оно переводится только при выводе
 void setEventWithCurrentTime(struct Event *event) {
-    time_t timer;
-    struct tm *tm_info;
-    timer = time(NULL);
-    tm_info = localtime(&timer);
-    strftime(event->timestamp, sizeof(event->timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
+    event->timestamp = monotonicNanoseconds() - server_started_at;
 }
 
 void writeEventToPipe(struct Event *event) {
@@ -330,7 +335,8 @@ void writeInfoToConsole() {
             exit(-1);
         }
         if (event.type == MAP) {
-            printf("%s\n", event.buffer);
+            printf("[%lld.%09lld]%s\n", event.timestamp / 1000000000LL,
+                   event.timestamp % 1000000000LL, event.buffer);
         }
     }
 }
@@ -391,6 +397,7 @@ int main(int argc, char *argv[]) {
         exit(-1);
     }
 
+    server_started_at = monotonicNanoseconds();
     if (pipe(pipe_fd) < 0) {
         perror("Can't open pipe");
         exit(-1);
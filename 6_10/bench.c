@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <netinet/tcp.h>
+
+// Структура, описывающая задачу
+struct Task {
+    int row;          // Номер строки
+    int col;          // Номер столбца
+    int worker_id;    // Идентификатор садовника
+    int duration;     // Время выполнения
+    int status;       // Статус задачи
+};
+
+// Структура, описывающая размер поля
+struct FieldDimensions {
+    int numRows;      // Количество строк
+    int numCols;      // Количество столбцов
+};
+
+// Результаты одного садовника, общие с процессом замера
+struct GardenerResult {
+    long plots;            // Количество подтвержденных участков
+    double connectedAt;    // Момент подключения, с
+    double finishedAt;     // Момент последнего подтверждения, с
+};
+
+// Параметры замера
+struct BenchOptions {
+    int gardeners;         // Количество синтетических садовников
+    int duration;          // Время работы садовника над участком
+    unsigned int seed;     // Зерно для поля сервера и стартовых линий садовников
+    int json;              // Вывод результата одной строкой JSON
+    char *serverPath;      // Путь к исполняемому файлу сервера
+    int serverArgsFrom;    // Индекс первого параметра сервера в argv
+};
+
+#define MAX_GARDENERS 1024
+#define CONNECT_ATTEMPTS 500
+
+// Функция для получения монотонного времени в секундах
+double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// Функция для подключения к серверу, который может еще запускаться
+int connectWithRetry(int port) {
+    struct sockaddr_in serverAddr;
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    serverAddr.sin_port = htons(port);
+
+    for (int attempt = 0; attempt < CONNECT_ATTEMPTS; ++attempt) {
+        int socketDescriptor = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (socketDescriptor < 0) {
+            perror("Creation os socket failed");
+            exit(EXIT_FAILURE);
+        }
+        if (connect(socketDescriptor, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) == 0) {
+            return socketDescriptor;
+        }
+        close(socketDescriptor);
+        usleep(10000);
+    }
+
+    perror("Connection to server went wrong");
+    exit(EXIT_FAILURE);
+}
+
+// Функция для чтения ровно size байт из сокета
+void receiveExactly(int socketDescriptor, void *buffer, int size) {
+    int received = 0;
+    while (received < size) {
+        int bytes = recv(socketDescriptor, (char *)buffer + received, size - received, 0);
+        if (bytes <= 0) {
+            perror("Error receiving response");
+            exit(EXIT_FAILURE);
+        }
+        received += bytes;
+    }
+}
+
+// Функция для отправки задачи и замера времени до подтверждения, нс
+long sendTimedTask(int socketDescriptor, struct Task task) {
+    struct timespec start, finish;
+    int serverResponse;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (send(socketDescriptor, &task, sizeof(task), 0) != sizeof(task)) {
+        perror("Error sending task");
+        exit(EXIT_FAILURE);
+    }
+    receiveExactly(socketDescriptor, &serverResponse, sizeof(serverResponse));
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    return (finish.tv_sec - start.tv_sec) * 1000000000L + (finish.tv_nsec - start.tv_nsec);
+}
+
+// Функция синтетического садовника. Нечетные садовники идут змейкой по строкам, четные -
+// змейкой по столбцам от нижнего правого угла, как first и second. Первые два начинают
+// с края поля, остальные - со строки (столбца), выбранной по зерну, и обходят поле по кругу
+void runGardener(int port, int id, struct BenchOptions options, struct GardenerResult *result,
+                 long *latencies) {
+    int socketDescriptor = connectWithRetry(port);
+    int noDelay = 1;
+    setsockopt(socketDescriptor, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    result->connectedAt = now();
+
+    struct FieldDimensions field;
+    receiveExactly(socketDescriptor, &field, sizeof(field));
+
+    unsigned int seed = options.seed + id;
+    int byRows = id % 2 == 1;
+    int lines = byRows ? field.numRows : field.numCols;
+    int length = byRows ? field.numCols : field.numRows;
+    int firstLine = id <= 2 ? 0 : rand_r(&seed) % lines;
+
+    struct Task task;
+    task.worker_id = id;
+    task.duration = options.duration;
+    task.status = 0;
+    for (int k = 0; k < lines; ++k) {
+        int line = (firstLine + k) % lines;
+        for (int step = 0; step < length; ++step) {
+            int position = k % 2 == 0 ? step : length - 1 - step;
+            if (byRows) {
+                task.row = line;
+                task.col = position;
+            } else {
+                task.row = field.numRows - 1 - position;
+                task.col = field.numCols - 1 - line;
+            }
+            latencies[result->plots++] = sendTimedTask(socketDescriptor, task);
+        }
+    }
+
+    task.status = 1;
+    sendTimedTask(socketDescriptor, task);
+    result->finishedAt = now();
+    close(socketDescriptor);
+}
+
+// Функция для запуска сервера с выводом в /dev/null
+pid_t startServer(int argc, char *argv[], struct BenchOptions options) {
+    char seed[32];
+    sprintf(seed, "--seed=%u", options.seed);
+    char *serverArgs[argc + 8];
+    int count = 0;
+    serverArgs[count++] = options.serverPath;
+    serverArgs[count++] = "127.0.0.1";
+    serverArgs[count++] = argv[1];
+    serverArgs[count++] = argv[2];
+    serverArgs[count++] = argv[3];
+    serverArgs[count++] = seed;
+    for (int i = options.serverArgsFrom; i < argc; ++i) {
+        serverArgs[count++] = argv[i];
+    }
+    serverArgs[count] = NULL;
+
+    pid_t serverPid = fork();
+    if (serverPid < 0) {
+        perror("Unable to start server");
+        exit(EXIT_FAILURE);
+    } else if (serverPid == 0) {
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        execv(options.serverPath, serverArgs);
+        perror("Unable to start server");
+        exit(EXIT_FAILURE);
+    }
+    return serverPid;
+}
+
+int compareLatencies(const void *a, const void *b) {
+    long left = *(const long *)a;
+    long right = *(const long *)b;
+    return (left > right) - (left < right);
+}
+
+// Функция для получения перцентиля из отсортированного массива задержек, мкс
+double percentile(long *latencies, long count, double fraction) {
+    if (count == 0) {
+        return 0;
+    }
+    long index = (long)(fraction * (count - 1) + 0.5);
+    return latencies[index] / 1000.0;
+}
+
+double cpuSeconds(struct rusage *usage) {
+    return usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6 + usage->ru_stime.tv_sec +
+           usage->ru_stime.tv_usec / 1e6;
+}
+
+int parseBenchOptions(int argc, char *argv[], struct BenchOptions *options) {
+    options->gardeners = 2;
+    options->duration = 0;
+    options->seed = 1;
+    options->json = 0;
+    options->serverPath = "./server";
+    options->serverArgsFrom = argc;
+
+    for (int i = 4; i < argc; ++i) {
+        if (strcmp(argv[i], "--") == 0) {
+            options->serverArgsFrom = i + 1;
+            break;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            options->json = 1;
+        } else if (strncmp(argv[i], "--gardeners=", 12) == 0 &&
+                   (options->gardeners = atoi(argv[i] + 12)) > 0 &&
+                   options->gardeners <= MAX_GARDENERS) {
+            continue;
+        } else if (strncmp(argv[i], "--work=", 7) == 0 &&
+                   (options->duration = atoi(argv[i] + 7)) >= 0) {
+            continue;
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            options->seed = strtoul(argv[i] + 7, NULL, 10);
+        } else if (strncmp(argv[i], "--server=", 9) == 0) {
+            options->serverPath = argv[i] + 9;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    struct BenchOptions options;
+    int rows, cols;
+
+    // Размер поля нужен заранее, чтобы выделить память под задержки
+    int validArgs = argc >= 4 && parseBenchOptions(argc, argv, &options) == 0;
+    if (validArgs && sscanf(argv[3], "%dx%d", &rows, &cols) != 2) {
+        rows = cols = 2 * atoi(argv[3]);
+    }
+    if (!validArgs || rows < 1 || cols < 1) {
+        fprintf(stderr,
+                "Arguments: %s <server port> <observer port> <grid side size | RxC> "
+                "[--gardeners=N] [--work=MS] [--seed=N] [--server=PATH] [--json] "
+                "[-- server options]\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    int port = atoi(argv[1]);
+    long cells = (long)rows * cols;
+
+    // Результаты и задержки садовников в общей памяти, чтобы собрать их после завершения
+    struct GardenerResult *results =
+        mmap(NULL, options.gardeners * sizeof(struct GardenerResult), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    long *latencies = mmap(NULL, options.gardeners * cells * sizeof(long), PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED || latencies == MAP_FAILED) {
+        perror("Unable to allocate results");
+        exit(EXIT_FAILURE);
+    }
+
+    pid_t serverPid = startServer(argc, argv, options);
+
+    for (int k = 0; k < options.gardeners; ++k) {
+        pid_t gardenerPid = fork();
+        if (gardenerPid < 0) {
+            perror("Unable to start gardener");
+            exit(EXIT_FAILURE);
+        } else if (gardenerPid == 0) {
+            runGardener(port, k + 1, options, results + k, latencies + k * cells);
+            exit(EXIT_SUCCESS);
+        }
+    }
+
+    int failed = 0;
+    for (int k = 0; k < options.gardeners; ++k) {
+        int status;
+        wait(&status);
+        failed += !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS;
+    }
+    struct rusage gardenersUsage;
+    getrusage(RUSAGE_CHILDREN, &gardenersUsage);
+
+    // Сервер при остановке дожидается своих процессов, поэтому их время входит в его время
+    struct rusage serverUsage;
+    int status;
+    kill(serverPid, SIGINT);
+    wait4(serverPid, &status, 0, &serverUsage);
+
+    long plots = 0;
+    double startedAt = 0, finishedAt = 0;
+    for (int k = 0; k < options.gardeners; ++k) {
+        if (results[k].plots == 0) {
+            continue;
+        }
+        // Задержки всех садовников собираются в один непрерывный массив
+        memmove(latencies + plots, latencies + k * cells, results[k].plots * sizeof(long));
+        plots += results[k].plots;
+        if (startedAt == 0 || results[k].connectedAt < startedAt) {
+            startedAt = results[k].connectedAt;
+        }
+        if (results[k].finishedAt > finishedAt) {
+            finishedAt = results[k].finishedAt;
+        }
+    }
+    qsort(latencies, plots, sizeof(long), compareLatencies);
+
+    double seconds = finishedAt - startedAt;
+    double throughput = seconds > 0 ? plots / seconds : 0;
+    double serverCpu = cpuSeconds(&serverUsage);
+    const char *format = options.json
+                             ? "{\"rows\": %d, \"columns\": %d, \"gardeners\": %d, \"work\": %d, "
+                               "\"seed\": %u, \"plots\": %ld, \"failed\": %d, \"seconds\": %.3f, "
+                               "\"plots_per_sec\": %.0f, \"p50_us\": %.1f, \"p90_us\": %.1f, "
+                               "\"p99_us\": %.1f, \"max_us\": %.1f, \"server_cpu_sec\": %.3f, "
+                               "\"gardeners_cpu_sec\": %.3f}\n"
+                             : "rows=%d columns=%d gardeners=%d work=%d seed=%u plots=%ld "
+                               "failed=%d seconds=%.3f plots_per_sec=%.0f p50_us=%.1f "
+                               "p90_us=%.1f p99_us=%.1f max_us=%.1f server_cpu_sec=%.3f "
+                               "gardeners_cpu_sec=%.3f\n";
+    printf(format, rows, cols, options.gardeners, options.duration, options.seed, plots, failed,
+           seconds, throughput, percentile(latencies, plots, 0.5),
+           percentile(latencies, plots, 0.9), percentile(latencies, plots, 0.99),
+           percentile(latencies, plots, 1.0), serverCpu, cpuSeconds(&gardenersUsage));
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,53 @@
+if [[ $# -lt 4 ]] ;
+then
+    echo "You should pass at least 4 args: ip, port, observer port, grid side size [server options]"
+    exit 1
+fi
+
+# Замер пропускной способности (участков в секунду) для обычного, пакетного и конвейерного
+# протокола. По умолчанию время работы садовников нулевое, поэтому измеряются только накладные
+# расходы. GARDENERS задает число пар садовников (first + second), подключающихся одновременно,
+# WORK - время работы садовника над участком в мс, SYNC - список режимов синхронизации
+# сервера для сравнения (например, "sem cas").
+pairs=${GARDENERS:-1}
+work=${WORK:-0}
+plots=$((pairs * 2 * (2 * $4) * (2 * $4)))
+log=$(mktemp)
+
+for sync in ${SYNC:-default} ; do
+for mode in "" "--batch" "--window=16" ; do
+    sync_option=()
+    if [[ $sync != default ]] ; then
+        sync_option=(--sync=$sync)
+    fi
+    ./server $1 $2 $3 $4 "${sync_option[@]}" "${@:5}" > $log &
+    server_pid=$!
+    sleep 0.5
+
+    start=$(date +%s.%N)
+    gardener_pids=()
+    for ((k = 0; k < pairs; ++k)) ; do
+        ./first $1 $2 $work $mode > /dev/null &
+        gardener_pids+=($!)
+        ./second $1 $2 $work $mode > /dev/null &
+        gardener_pids+=($!)
+    done
+    wait ${gardener_pids[@]}
+    finish=$(date +%s.%N)
+
+    kill -INT $server_pid
+    wait $server_pid
+
+    # Время от принятия соединения до первого подтверждения садовнику
+    grep "First ack" $log | awk -v sync=$sync -v mode="${mode:-single}" -v plots=$plots -v start=$start \
+        -v finish=$finish '{
+        sum += $8; if ($8 > max) max = $8; ++count
+    } END {
+        printf "sync=%s mode=%s plots=%d seconds=%.3f plots_per_sec=%.0f", sync, mode, plots,
+               finish - start, plots / (finish - start)
+        printf " first_ack_avg_us=%.0f first_ack_max_us=%d\n", count ? sum / count : 0, max
+    }'
+done
+done
+
+rm -f $log
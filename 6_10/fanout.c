@@ -0,0 +1,467 @@
+#include <stdio.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/tcp.h>
+
+// Структура, описывающая задачу
+struct Task {
+    int row;          // Номер строки
+    int col;          // Номер столбца
+    int worker_id;    // Идентификатор садовника
+    int duration;     // Время выполнения
+    int status;       // Статус задачи
+};
+
+// Структура, описывающая размер поля
+struct FieldDimensions {
+    int numRows;      // Количество строк
+    int numCols;      // Количество столбцов
+};
+
+// Типы сообщений от сервера: текст, полный снимок поля и изменение одной клетки
+enum MessageType { TEXT_MESSAGE, SNAPSHOT_MESSAGE, DELTA_MESSAGE };
+
+// Заголовок сообщения от сервера, за ним следует length байт данных
+struct MessageHeader {
+    int type;
+    unsigned int length;
+};
+
+// Начало снимка поля, за ним следуют упакованные клетки
+struct SnapshotHeader {
+    long long sequence;
+    int rows;
+    int columns;
+    int bits_per_cell;
+};
+
+// Изменение клетки поля с порядковым номером изменения
+struct Delta {
+    long long sequence;
+    int row;
+    int column;
+    int value;
+};
+
+// Разбор потока сообщений одного наблюдателя. Сохраняется только номер последнего изменения
+struct ObserverStream {
+    int socket;
+    char header[sizeof(struct MessageHeader)];
+    int headerReceived;
+    int type;
+    unsigned int bodyLeft;
+    char delta[sizeof(struct Delta)];
+    int deltaReceived;
+    int hasSnapshot;
+    long long lastSequence;
+    int done;              // условие текущего ожидания выполнено
+};
+
+// Параметры замера
+struct FanoutOptions {
+    int observers;         // Количество наблюдателей
+    int plots;             // Количество участков, изменения которых рассылаются
+    int json;              // Вывод результата одной строкой JSON
+    char *serverPath;      // Путь к исполняемому файлу сервера
+    int serverArgsFrom;    // Индекс первого параметра сервера в argv
+};
+
+#define CONNECT_ATTEMPTS 500
+#define MAX_OBSERVERS 100000
+// Сколько ждать, пока изменение дойдет до всех наблюдателей, мс
+#define DELIVERY_TIMEOUT 5000
+
+// Функция для получения монотонного времени в наносекундах
+long nowNanoseconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000L + time.tv_nsec;
+}
+
+// Функция для подключения к серверу, который может еще запускаться
+int connectWithRetry(int port) {
+    struct sockaddr_in serverAddr;
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    serverAddr.sin_port = htons(port);
+
+    for (int attempt = 0; attempt < CONNECT_ATTEMPTS; ++attempt) {
+        int socketDescriptor = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (socketDescriptor < 0) {
+            perror("Creation os socket failed");
+            exit(EXIT_FAILURE);
+        }
+        if (connect(socketDescriptor, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) == 0) {
+            return socketDescriptor;
+        }
+        close(socketDescriptor);
+        usleep(10000);
+    }
+
+    perror("Connection to server went wrong");
+    exit(EXIT_FAILURE);
+}
+
+// Функция для чтения ровно size байт из сокета
+void receiveExactly(int socketDescriptor, void *buffer, int size) {
+    int received = 0;
+    while (received < size) {
+        int bytes = recv(socketDescriptor, (char *)buffer + received, size - received, 0);
+        if (bytes <= 0) {
+            perror("Error receiving response");
+            exit(EXIT_FAILURE);
+        }
+        received += bytes;
+    }
+}
+
+// Функция для запуска сервера с выводом в /dev/null
+pid_t startServer(int argc, char *argv[], struct FanoutOptions options) {
+    char *serverArgs[argc + 8];
+    int count = 0;
+    serverArgs[count++] = options.serverPath;
+    serverArgs[count++] = "127.0.0.1";
+    serverArgs[count++] = argv[1];
+    serverArgs[count++] = argv[2];
+    serverArgs[count++] = argv[3];
+    for (int i = options.serverArgsFrom; i < argc; ++i) {
+        serverArgs[count++] = argv[i];
+    }
+    serverArgs[count] = NULL;
+
+    pid_t serverPid = fork();
+    if (serverPid < 0) {
+        perror("Unable to start server");
+        exit(EXIT_FAILURE);
+    } else if (serverPid == 0) {
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        execv(options.serverPath, serverArgs);
+        perror("Unable to start server");
+        exit(EXIT_FAILURE);
+    }
+    return serverPid;
+}
+
+// Функция для получения обрабатываемых клеток из снимка пробного наблюдателя.
+// Возвращает их номера в порядке строк
+long *readProcessablePlots(int port, int plots, int *rows, int *cols, int *found) {
+    int socketDescriptor = connectWithRetry(port);
+    struct MessageHeader header;
+    receiveExactly(socketDescriptor, &header, sizeof(header));
+    if (header.type != SNAPSHOT_MESSAGE) {
+        fprintf(stderr, "Server did not start with a snapshot\n");
+        exit(EXIT_FAILURE);
+    }
+    struct SnapshotHeader snapshot;
+    receiveExactly(socketDescriptor, &snapshot, sizeof(snapshot));
+    unsigned int packedSize = header.length - sizeof(snapshot);
+    unsigned char *packed = malloc(packedSize);
+    long *cells = malloc(plots * sizeof(long));
+    if (packed == NULL || cells == NULL) {
+        perror("Unable to allocate snapshot");
+        exit(EXIT_FAILURE);
+    }
+    receiveExactly(socketDescriptor, packed, packedSize);
+    close(socketDescriptor);
+
+    // Пока на поле нет садовников, клетка занимает 2 бита, код 1 - необработанная клетка
+    *found = 0;
+    for (long k = 0; k < (long)snapshot.rows * snapshot.columns && *found < plots; ++k) {
+        if (((packed[k / 4] >> (k % 4 * 2)) & 3) == 1) {
+            cells[(*found)++] = k;
+        }
+    }
+    *rows = snapshot.rows;
+    *cols = snapshot.columns;
+    free(packed);
+    return cells;
+}
+
+// Функция для разбора прочитанных байт наблюдателя. Тело всех сообщений, кроме изменений,
+// пропускается
+void consumeBytes(struct ObserverStream *stream, const char *data, int size) {
+    while (size > 0) {
+        if (stream->headerReceived < (int)sizeof(stream->header)) {
+            int part = sizeof(stream->header) - stream->headerReceived;
+            part = part < size ? part : size;
+            memcpy(stream->header + stream->headerReceived, data, part);
+            stream->headerReceived += part;
+            data += part;
+            size -= part;
+            if (stream->headerReceived == (int)sizeof(stream->header)) {
+                struct MessageHeader header;
+                memcpy(&header, stream->header, sizeof(header));
+                stream->type = header.type;
+                stream->bodyLeft = header.length;
+                stream->deltaReceived = 0;
+            }
+        } else {
+            int part = stream->bodyLeft < (unsigned int)size ? (int)stream->bodyLeft : size;
+            if (stream->type == DELTA_MESSAGE &&
+                stream->deltaReceived + part <= (int)sizeof(stream->delta)) {
+                memcpy(stream->delta + stream->deltaReceived, data, part);
+                stream->deltaReceived += part;
+            }
+            stream->bodyLeft -= part;
+            data += part;
+            size -= part;
+        }
+
+        if (stream->headerReceived == (int)sizeof(stream->header) && stream->bodyLeft == 0) {
+            if (stream->type == SNAPSHOT_MESSAGE) {
+                stream->hasSnapshot = 1;
+            } else if (stream->type == DELTA_MESSAGE &&
+                       stream->deltaReceived == (int)sizeof(stream->delta)) {
+                struct Delta delta;
+                memcpy(&delta, stream->delta, sizeof(delta));
+                if (delta.sequence > stream->lastSequence) {
+                    stream->lastSequence = delta.sequence;
+                }
+            }
+            stream->headerReceived = 0;
+        }
+    }
+}
+
+// Функция для чтения всего доступного из сокета наблюдателя
+void readStream(struct ObserverStream *stream) {
+    char buffer[65536];
+    while (1) {
+        int bytes = recv(stream->socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (bytes <= 0) {
+            fprintf(stderr, "Observer connection lost\n");
+            exit(EXIT_FAILURE);
+        }
+        consumeBytes(stream, buffer, bytes);
+    }
+}
+
+// Условие ожидания: снимок получен (sequence < 0) или получено изменение с номером
+// не меньше sequence
+int streamDone(struct ObserverStream *stream, long long sequence) {
+    return sequence < 0 ? stream->hasSnapshot : stream->lastSequence >= sequence;
+}
+
+// Функция для чтения готовых к чтению наблюдателей. Возвращает, у скольких из них условие
+// выполнилось впервые, или -1, если за timeout мс ничего не пришло
+int readReadyObservers(int epollDescriptor, struct ObserverStream *streams, long long sequence,
+                       int timeout) {
+    struct epoll_event events[256];
+    int ready = epoll_wait(epollDescriptor, events, 256, timeout);
+    if (ready < 0 && errno == EINTR) {
+        return 0;
+    }
+    if (ready < 0 || (ready == 0 && timeout > 0)) {
+        return -1;
+    }
+    int done = 0;
+    for (int k = 0; k < ready; ++k) {
+        struct ObserverStream *stream = streams + events[k].data.u32;
+        readStream(stream);
+        if (!stream->done && streamDone(stream, sequence)) {
+            stream->done = 1;
+            done++;
+        }
+    }
+    return done;
+}
+
+// Функция для чтения наблюдателей, пока у всех не выполнится условие. Возвращает время
+// выполнения условия у первого и последнего наблюдателя, нс от startedAt, или -1 по таймауту
+int waitForObservers(int epollDescriptor, struct ObserverStream *streams, int count,
+                     long long sequence, long startedAt, long *first, long *last) {
+    int done = 0;
+    *first = -1;
+    for (int k = 0; k < count; ++k) {
+        streams[k].done = streamDone(streams + k, sequence);
+        done += streams[k].done;
+    }
+
+    while (done < count) {
+        int newlyDone = readReadyObservers(epollDescriptor, streams, sequence, DELIVERY_TIMEOUT);
+        if (newlyDone < 0) {
+            return -1;
+        }
+        if (newlyDone > 0 && *first < 0) {
+            *first = nowNanoseconds() - startedAt;
+        }
+        done += newlyDone;
+    }
+    *last = nowNanoseconds() - startedAt;
+    if (*first < 0) {
+        *first = *last;
+    }
+    return 0;
+}
+
+int compareLatencies(const void *a, const void *b) {
+    long left = *(const long *)a;
+    long right = *(const long *)b;
+    return (left > right) - (left < right);
+}
+
+// Функция для получения перцентиля из отсортированного массива задержек, мкс
+double percentile(long *latencies, long count, double fraction) {
+    if (count == 0) {
+        return 0;
+    }
+    long index = (long)(fraction * (count - 1) + 0.5);
+    return latencies[index] / 1000.0;
+}
+
+int parseFanoutOptions(int argc, char *argv[], struct FanoutOptions *options) {
+    options->observers = 1;
+    options->plots = 200;
+    options->json = 0;
+    options->serverPath = "./server";
+    options->serverArgsFrom = argc;
+
+    for (int i = 4; i < argc; ++i) {
+        if (strcmp(argv[i], "--") == 0) {
+            options->serverArgsFrom = i + 1;
+            break;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            options->json = 1;
+        } else if (strncmp(argv[i], "--observers=", 12) == 0 &&
+                   (options->observers = atoi(argv[i] + 12)) > 0 &&
+                   options->observers <= MAX_OBSERVERS) {
+            continue;
+        } else if (strncmp(argv[i], "--plots=", 8) == 0 &&
+                   (options->plots = atoi(argv[i] + 8)) > 0) {
+            continue;
+        } else if (strncmp(argv[i], "--server=", 9) == 0) {
+            options->serverPath = argv[i] + 9;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    struct FanoutOptions options;
+    if (argc < 4 || parseFanoutOptions(argc, argv, &options) < 0) {
+        fprintf(stderr,
+                "Arguments: %s <server port> <observer port> <grid side size | RxC> "
+                "[--observers=N] [--plots=N] [--server=PATH] [--json] [-- server options]\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    int port = atoi(argv[1]);
+    int observerPort = atoi(argv[2]);
+
+    // Каждому наблюдателю нужен дескриптор
+    struct rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    pid_t serverPid = startServer(argc, argv, options);
+
+    int rows, cols, plots;
+    long *cells = readProcessablePlots(observerPort, options.plots, &rows, &cols, &plots);
+
+    struct ObserverStream *streams = calloc(options.observers, sizeof(struct ObserverStream));
+    long *firstLatencies = malloc(plots * sizeof(long));
+    long *lastLatencies = malloc(plots * sizeof(long));
+    int epollDescriptor = epoll_create1(0);
+    if (streams == NULL || firstLatencies == NULL || lastLatencies == NULL ||
+        epollDescriptor < 0) {
+        perror("Unable to allocate observers");
+        exit(EXIT_FAILURE);
+    }
+
+    long connectStartedAt = nowNanoseconds();
+    for (int k = 0; k < options.observers; ++k) {
+        streams[k].socket = connectWithRetry(observerPort);
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u32 = k;
+        if (epoll_ctl(epollDescriptor, EPOLL_CTL_ADD, streams[k].socket, &event) < 0) {
+            perror("Unable to watch observer");
+            exit(EXIT_FAILURE);
+        }
+        // Снимки читаются по ходу подключения: непрочитанные данные тысяч сокетов упираются
+        // в лимит памяти TCP (net.ipv4.tcp_mem), и ядро начинает тормозить все соединения
+        readReadyObservers(epollDescriptor, streams, -1, 0);
+    }
+    long firstSnapshot, lastSnapshot;
+    if (waitForObservers(epollDescriptor, streams, options.observers, -1, connectStartedAt,
+                         &firstSnapshot, &lastSnapshot) < 0) {
+        fprintf(stderr, "Observers did not receive snapshots\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int gardener = connectWithRetry(port);
+    int noDelay = 1;
+    setsockopt(gardener, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    struct FieldDimensions field;
+    receiveExactly(gardener, &field, sizeof(field));
+
+    // Садовник один, поэтому k-й обработанный участок дает изменение с номером k + 1.
+    // Следующий участок отправляется, только когда изменение дошло до всех наблюдателей
+    struct Task task;
+    task.worker_id = 1;
+    task.duration = 0;
+    task.status = 0;
+    int delivered = 0;
+    for (; delivered < plots; ++delivered) {
+        task.row = cells[delivered] / cols;
+        task.col = cells[delivered] % cols;
+        long startedAt = nowNanoseconds();
+        int serverResponse;
+        if (send(gardener, &task, sizeof(task), 0) != sizeof(task)) {
+            perror("Error sending task");
+            exit(EXIT_FAILURE);
+        }
+        receiveExactly(gardener, &serverResponse, sizeof(serverResponse));
+        if (waitForObservers(epollDescriptor, streams, options.observers, delivered + 1,
+                             startedAt, firstLatencies + delivered,
+                             lastLatencies + delivered) < 0) {
+            break;
+        }
+    }
+
+    task.status = 1;
+    send(gardener, &task, sizeof(task), 0);
+    close(gardener);
+    for (int k = 0; k < options.observers; ++k) {
+        close(streams[k].socket);
+    }
+    int status;
+    kill(serverPid, SIGINT);
+    waitpid(serverPid, &status, 0);
+
+    qsort(firstLatencies, delivered, sizeof(long), compareLatencies);
+    qsort(lastLatencies, delivered, sizeof(long), compareLatencies);
+    const char *format = options.json
+                             ? "{\"observers\": %d, \"plots\": %d, \"missed\": %d, "
+                               "\"join_sec\": %.3f, \"first_p50_us\": %.1f, "
+                               "\"first_p99_us\": %.1f, \"all_p50_us\": %.1f, "
+                               "\"all_p99_us\": %.1f, \"all_max_us\": %.1f}\n"
+                             : "observers=%d plots=%d missed=%d join_sec=%.3f first_p50_us=%.1f "
+                               "first_p99_us=%.1f all_p50_us=%.1f all_p99_us=%.1f "
+                               "all_max_us=%.1f\n";
+    printf(format, options.observers, delivered, plots - delivered, lastSnapshot / 1e9,
+           percentile(firstLatencies, delivered, 0.5), percentile(firstLatencies, delivered, 0.99),
+           percentile(lastLatencies, delivered, 0.5), percentile(lastLatencies, delivered, 0.99),
+           percentile(lastLatencies, delivered, 1.0));
+
+    return delivered == plots ? EXIT_SUCCESS : EXIT_FAILURE;
+}
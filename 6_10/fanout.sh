@@ -0,0 +1,17 @@
+if [[ $# -lt 3 ]] ;
+then
+    echo "You should pass at least 3 args: port, observer port, grid side size [fanout options]"
+    exit 1
+fi
+
+# Задержка рассылки изменений в зависимости от числа наблюдателей. OBSERVERS - список размеров
+# (по умолчанию 1, 100, 1000 и 10000). Каждый запуск использует свою пару портов. Порты лучше
+# брать ниже net.ipv4.ip_local_port_range, иначе их может занять клиентский сокет наблюдателя.
+port=$1
+observer_port=$2
+
+for observers in ${OBSERVERS:-1 100 1000 10000} ; do
+    ./fanout $port $observer_port $3 --observers=$observers "${@:4}"
+    port=$((port + 2))
+    observer_port=$((observer_port + 2))
+done
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <netinet/tcp.h>
 
 // Структура, описывающая задачу
 struct Task {
@@ -14,6 +15,31 @@ struct Task {
     int status;       // Статус задачи
 };
 
+// Структура, описывающая отрезок участков для пакетной отправки
+struct Segment {
+    int count;        // Количество участков
+    int rowStep;      // Шаг по строкам
+    int colStep;      // Шаг по столбцам
+};
+
+// Структура, описывающая конвейер неподтвержденных задач
+struct Pipeline {
+    int socket;          // Сокет сервера
+    int window;          // Максимальное число неподтвержденных задач
+    int head;            // Индекс самой старой неподтвержденной задачи
+    int count;           // Количество неподтвержденных задач
+    struct Task *tasks;  // Кольцевой буфер отправленных задач
+};
+
+// Статус пакетной задачи и максимальный размер пакета
+#define TASK_BATCH 2
+#define MAX_BATCH 1024
+
+// Наибольшее окно конвейера. Клиент отправляет все задачи окна, не читая ответов, поэтому
+// ответы на окно (по 20 байт) должны помещаться в минимальный буфер сокета (4 КБ): иначе
+// клиент и сервер могут заблокироваться в send друг на друге. Большее --window уменьшается
+#define MAX_WINDOW 128
+
 // Структура, описывающая размер поля
 struct FieldDimensions {
     int numRows;      // Количество строк
@@ -25,7 +51,7 @@ enum EventType { MAP_EVENT, ACTION_EVENT, META_EVENT };
 
 // Структура, описывающая событие
 struct Event {
-    char timestamp[26];   // Временная метка
+    long long timestamp;  // Временная метка, нс
     char data[1024];      // Буфер данных
     enum EventType type;  // Тип события
 };
@@ -92,8 +118,147 @@ void sendTaskAndAwaitResponse(int clientSocket, struct Task task) {
     }
 }
 
+// Функция для отправки отрезка участков одним кадром и обработки ответа
+void sendSegmentAndAwaitResponse(int clientSocket, struct Task task, struct Segment segment) {
+    struct Task header = task;
+    header.status = TASK_BATCH;
+
+    // Задача и отрезок отправляются одним вызовом
+    char frame[sizeof(struct Task) + sizeof(struct Segment)];
+    memcpy(frame, &header, sizeof(header));
+    memcpy(frame + sizeof(header), &segment, sizeof(segment));
+    if (send(clientSocket, frame, sizeof(frame), 0) != sizeof(frame)) {
+        perror("Error sending segment");
+        exit(EXIT_FAILURE);
+    }
+
+    // Ответ: количество участков и значение поля для каждого из них
+    int results[MAX_BATCH + 1];
+    int expected = (segment.count + 1) * sizeof(int);
+    int received = 0;
+    while (received < expected) {
+        int bytes = recv(clientSocket, (char *)results + received, expected - received, 0);
+        if (bytes <= 0) {
+            perror("Error receiving response");
+            exit(EXIT_FAILURE);
+        }
+        received += bytes;
+    }
+
+    for (int k = 0; k < results[0]; ++k) {
+        printf("Gardener %d at row: %d, col: %d\n", task.worker_id,
+               task.row + k * segment.rowStep, task.col + k * segment.colStep);
+    }
+}
+
+// Функция, которая проходит строку поля пакетами не длиннее MAX_BATCH
+void processRow(int clientSocket, struct Task task, int length, int colStep) {
+    while (length > 0) {
+        struct Segment segment;
+        segment.count = length < MAX_BATCH ? length : MAX_BATCH;
+        segment.rowStep = 0;
+        segment.colStep = colStep;
+        sendSegmentAndAwaitResponse(clientSocket, task, segment);
+
+        task.col += segment.count * colStep;
+        length -= segment.count;
+    }
+}
+
+// Функция, которая выполняет задачи на поле пакетами по строкам
+void processFieldInBatches(int clientSocket, int duration, struct FieldDimensions field) {
+    struct Task task;
+    task.worker_id = 1;
+    task.duration = duration;
+    task.status = 0;
+
+    // Проход по полю змейкой, каждая строка отправляется целиком
+    for (int i = 0; i < field.numRows; ++i) {
+        task.row = i;
+        if (i % 2 == 0) {
+            task.col = 0;
+            processRow(clientSocket, task, field.numCols, 1);
+        } else {
+            task.col = field.numCols - 1;
+            processRow(clientSocket, task, field.numCols, -1);
+        }
+    }
+
+    // Завершение работы
+    task.status = 1;
+    sendTaskAndAwaitResponse(clientSocket, task);
+}
+
+// Функция для создания конвейера с окном из window задач
+struct Pipeline createPipeline(int clientSocket, int window) {
+    struct Pipeline pipeline;
+    pipeline.socket = clientSocket;
+    pipeline.window = window;
+    pipeline.head = 0;
+    pipeline.count = 0;
+    pipeline.tasks = malloc(window * sizeof(struct Task));
+    if (pipeline.tasks == NULL) {
+        perror("Error allocating pipeline");
+        exit(EXIT_FAILURE);
+    }
+
+    // Маленькие задачи не должны задерживаться алгоритмом Нейгла
+    if (window > 1) {
+        int noDelay = 1;
+        setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    }
+    return pipeline;
+}
+
+// Функция для ожидания подтверждения самой старой задачи конвейера
+void awaitOldestTask(struct Pipeline *pipeline) {
+    int serverResponse;
+    int received = 0;
+    while (received < (int)sizeof(serverResponse)) {
+        int bytes = recv(pipeline->socket, (char *)&serverResponse + received,
+                         sizeof(serverResponse) - received, 0);
+        if (bytes <= 0) {
+            perror("Error receiving response");
+            exit(EXIT_FAILURE);
+        }
+        received += bytes;
+    }
+
+    struct Task task = pipeline->tasks[pipeline->head];
+    printf("Gardener %d at row: %d, col: %d\n", task.worker_id, task.row, task.col);
+
+    pipeline->head = (pipeline->head + 1) % pipeline->window;
+    --pipeline->count;
+}
+
+// Функция для отправки задачи: ожидание происходит, только когда окно заполнено
+void submitTask(struct Pipeline *pipeline, struct Task task) {
+    if (pipeline->window <= 1) {
+        sendTaskAndAwaitResponse(pipeline->socket, task);
+        return;
+    }
+
+    if (pipeline->count == pipeline->window) {
+        awaitOldestTask(pipeline);
+    }
+
+    if (send(pipeline->socket, &task, sizeof(task), 0) != sizeof(task)) {
+        perror("Error sending task");
+        exit(EXIT_FAILURE);
+    }
+    pipeline->tasks[(pipeline->head + pipeline->count) % pipeline->window] = task;
+    ++pipeline->count;
+}
+
+// Функция для ожидания подтверждения всех отправленных задач
+void drainPipeline(struct Pipeline *pipeline) {
+    while (pipeline->count > 0) {
+        awaitOldestTask(pipeline);
+    }
+}
+
 // Функция, которая выполняет задачи на поле
-void processField(int clientSocket, int duration, struct FieldDimensions field) {
+void processField(struct Pipeline *pipeline, int duration, struct FieldDimensions field) {
     struct Task task;
     task.worker_id = 1;  // Идентификатор садовника
     task.duration = duration;
@@ -108,27 +273,29 @@ void processField(int clientSocket, int duration, struct FieldDimensions field)
         while (j < totalCols) {
             task.row = i;
             task.col = j;
-            sendTaskAndAwaitResponse(clientSocket, task);
+            submitTask(pipeline, task);
             ++j;
         }
 
         ++i;
         --j;
 
-        while (j >= 0) {
+        // При нечетном числе строк обратного прохода в последней строке нет
+        while (i < totalRows && j >= 0) {
             task.row = i;
             task.col = j;
-            sendTaskAndAwaitResponse(clientSocket, task);
+            submitTask(pipeline, task);
             --j;
         }
 
         ++i;
         ++j;
     }
+    drainPipeline(pipeline);
 
     // Завершение работы
     task.status = 1;
-    sendTaskAndAwaitResponse(clientSocket, task);
+    sendTaskAndAwaitResponse(pipeline->socket, task);
 }
 
 int main(int argc, char *argv[]) {
@@ -139,9 +306,22 @@ int main(int argc, char *argv[]) {
     char tempBuffer[256];
     int receivedBytes, totalReceivedBytes;
 
-    // Проверка количества аргументов командной строки
-    if (argc != 4) {
-        fprintf(stderr, "Arguments: %s <server IP> <server port> <work time>\n", argv[0]);
+    // Проверка аргументов командной строки
+    int useBatches = 0;
+    int window = 1;
+    int validArgs = argc == 4 || argc == 5;
+    if (argc == 5) {
+        if (strcmp(argv[4], "--batch") == 0) {
+            useBatches = 1;
+        } else if (strncmp(argv[4], "--window=", 9) != 0 || (window = atoi(argv[4] + 9)) < 1) {
+            validArgs = 0;
+        }
+    }
+    window = window < MAX_WINDOW ? window : MAX_WINDOW;
+    if (!validArgs) {
+        fprintf(stderr,
+                "Arguments: %s <server IP> <server port> <work time> [--batch | --window=N]\n",
+                argv[0]);
         exit(EXIT_FAILURE);
     }
 
@@ -161,7 +341,13 @@ int main(int argc, char *argv[]) {
     }
 
     // Выполнение работы на поле
-    processField(clientSocket, duration, fieldSize);
+    if (useBatches) {
+        processFieldInBatches(clientSocket, duration, fieldSize);
+    } else {
+        struct Pipeline pipeline = createPipeline(clientSocket, window);
+        processField(&pipeline, duration, fieldSize);
+        free(pipeline.tasks);
+    }
 
     printf("Work is done (1sr gardener)\n");
     close(clientSocket);
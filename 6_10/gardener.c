@@ -0,0 +1,446 @@
+#include <stdio.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/tcp.h>
+
+// Структура, описывающая задачу
+struct Task {
+    int row;          // Номер строки
+    int col;          // Номер столбца
+    int worker_id;    // Идентификатор садовника
+    int duration;     // Время выполнения
+    int status;       // Статус задачи
+};
+
+// Структура, описывающая отрезок участков для пакетной отправки
+struct Segment {
+    int count;        // Количество участков
+    int rowStep;      // Шаг по строкам
+    int colStep;      // Шаг по столбцам
+};
+
+// Структура, описывающая прямой отрезок маршрута садовника
+struct Line {
+    int row;          // Строка первого участка
+    int col;          // Столбец первого участка
+    int count;        // Количество участков
+    int rowStep;      // Шаг по строкам
+    int colStep;      // Шаг по столбцам
+};
+
+// Структура запроса "продвинь меня": стратегия и место в маршруте, с которого сервер
+// ищет следующий необработанный участок
+struct Route {
+    int strategy;     // Стратегия обхода
+    int firstLine;    // Первая строка обхода полосами
+    int line;         // Номер отрезка маршрута
+    int offset;       // Номер участка в отрезке
+};
+
+// Структура ответа на запрос "продвинь меня"
+struct Position {
+    int line;         // Номер отрезка маршрута (-1, если маршрут закончен)
+    int offset;       // Номер участка в отрезке
+    int row;          // Строка обработанного участка
+    int col;          // Столбец обработанного участка
+    int skipped;      // Количество пропущенных участков
+};
+
+// Структура, описывающая конвейер неподтвержденных задач
+struct Pipeline {
+    int socket;          // Сокет сервера
+    int window;          // Максимальное число неподтвержденных задач
+    int head;            // Индекс самой старой неподтвержденной задачи
+    int count;           // Количество неподтвержденных задач
+    struct Task *tasks;  // Кольцевой буфер отправленных задач
+};
+
+// Статус пакетной задачи и максимальный размер пакета
+#define TASK_BATCH 2
+#define TASK_ADVANCE 3
+#define MAX_BATCH 1024
+
+// Наибольшее окно конвейера. Клиент отправляет все задачи окна, не читая ответов, поэтому
+// ответы на окно (по 20 байт) должны помещаться в минимальный буфер сокета (4 КБ): иначе
+// клиент и сервер могут заблокироваться в send друг на друге. Большее --window уменьшается
+#define MAX_WINDOW 128
+
+// Структура, описывающая размер поля
+struct FieldDimensions {
+    int numRows;      // Количество строк
+    int numCols;      // Количество столбцов
+};
+
+// Перечисление стратегий обхода поля
+enum Strategy { ROW_SNAKE, COLUMN_SNAKE, SPIRAL, STRIPE };
+
+// Структура, описывающая параметры садовника
+struct GardenerOptions {
+    int id;                  // Идентификатор садовника (больше 0)
+    int duration;            // Время работы над участком
+    enum Strategy strategy;  // Стратегия обхода
+    int gardeners;           // Количество садовников, между которыми делятся полосы
+    int useBatches;          // Отправка отрезков маршрута пакетами
+    int window;              // Размер окна конвейера
+    int advance;             // Сервер сам ведет садовника по маршруту
+};
+
+// Функция для создания клиентского сокета и подключения к серверу
+int initializeClientSocket(char *ipAddress, int port) {
+    int socketDescriptor;
+
+    // Создание сокета
+    if ((socketDescriptor = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+        perror("Creation os socket failed");
+        exit(EXIT_FAILURE);
+    }
+
+    // Настройка адреса сервера
+    struct sockaddr_in serverAddr;
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_addr.s_addr = inet_addr(ipAddress);
+    serverAddr.sin_port = htons(port);
+
+    // Подключение к серверу
+    if (connect(socketDescriptor, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0) {
+        perror("Connection to server went wrong");
+        exit(EXIT_FAILURE);
+    }
+
+    return socketDescriptor;
+}
+
+// Функция для чтения ровно size байт из сокета
+void receiveExactly(int socketDescriptor, void *buffer, int size) {
+    int received = 0;
+    while (received < size) {
+        int bytes = recv(socketDescriptor, (char *)buffer + received, size - received, 0);
+        if (bytes <= 0) {
+            perror("Error receiving response");
+            exit(EXIT_FAILURE);
+        }
+        received += bytes;
+    }
+}
+
+// Функция для отправки задачи на сервер и ожидания подтверждения
+void sendTaskAndAwaitResponse(int clientSocket, struct Task task) {
+    int serverResponse;
+    if (send(clientSocket, &task, sizeof(task), 0) != sizeof(task)) {
+        perror("Error sending task");
+        exit(EXIT_FAILURE);
+    }
+    receiveExactly(clientSocket, &serverResponse, sizeof(serverResponse));
+
+    if (task.status != 1) {
+        printf("Gardener %d at row: %d, col: %d\n", task.worker_id, task.row, task.col);
+    }
+}
+
+// Функция для отправки отрезка участков одним кадром и обработки ответа
+void sendSegmentAndAwaitResponse(int clientSocket, struct Task task, struct Segment segment) {
+    struct Task header = task;
+    header.status = TASK_BATCH;
+
+    // Задача и отрезок отправляются одним вызовом
+    char frame[sizeof(struct Task) + sizeof(struct Segment)];
+    memcpy(frame, &header, sizeof(header));
+    memcpy(frame + sizeof(header), &segment, sizeof(segment));
+    if (send(clientSocket, frame, sizeof(frame), 0) != sizeof(frame)) {
+        perror("Error sending segment");
+        exit(EXIT_FAILURE);
+    }
+
+    // Ответ: количество участков и значение поля для каждого из них
+    int results[MAX_BATCH + 1];
+    receiveExactly(clientSocket, results, (segment.count + 1) * sizeof(int));
+
+    for (int k = 0; k < results[0]; ++k) {
+        printf("Gardener %d at row: %d, col: %d\n", task.worker_id,
+               task.row + k * segment.rowStep, task.col + k * segment.colStep);
+    }
+}
+
+// Функция для создания конвейера с окном из window задач
+struct Pipeline createPipeline(int clientSocket, int window) {
+    struct Pipeline pipeline;
+    pipeline.socket = clientSocket;
+    pipeline.window = window;
+    pipeline.head = 0;
+    pipeline.count = 0;
+    pipeline.tasks = malloc(window * sizeof(struct Task));
+    if (pipeline.tasks == NULL) {
+        perror("Error allocating pipeline");
+        exit(EXIT_FAILURE);
+    }
+
+    // Маленькие задачи не должны задерживаться алгоритмом Нейгла
+    if (window > 1) {
+        int noDelay = 1;
+        setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    }
+    return pipeline;
+}
+
+// Функция для ожидания подтверждения самой старой задачи конвейера
+void awaitOldestTask(struct Pipeline *pipeline) {
+    int serverResponse;
+    receiveExactly(pipeline->socket, &serverResponse, sizeof(serverResponse));
+
+    struct Task task = pipeline->tasks[pipeline->head];
+    printf("Gardener %d at row: %d, col: %d\n", task.worker_id, task.row, task.col);
+
+    pipeline->head = (pipeline->head + 1) % pipeline->window;
+    --pipeline->count;
+}
+
+// Функция для отправки задачи: ожидание происходит, только когда окно заполнено
+void submitTask(struct Pipeline *pipeline, struct Task task) {
+    if (pipeline->window <= 1) {
+        sendTaskAndAwaitResponse(pipeline->socket, task);
+        return;
+    }
+
+    if (pipeline->count == pipeline->window) {
+        awaitOldestTask(pipeline);
+    }
+
+    if (send(pipeline->socket, &task, sizeof(task), 0) != sizeof(task)) {
+        perror("Error sending task");
+        exit(EXIT_FAILURE);
+    }
+    pipeline->tasks[(pipeline->head + pipeline->count) % pipeline->window] = task;
+    ++pipeline->count;
+}
+
+// Функция для ожидания подтверждения всех отправленных задач
+void drainPipeline(struct Pipeline *pipeline) {
+    while (pipeline->count > 0) {
+        awaitOldestTask(pipeline);
+    }
+}
+
+// Функция для добавления отрезка к маршруту
+void addLine(struct Line *lines, int *count, int row, int col, int length, int rowStep,
+             int colStep) {
+    if (length > 0) {
+        struct Line line = { row, col, length, rowStep, colStep };
+        lines[(*count)++] = line;
+    }
+}
+
+// Функция для получения первой строки полосы садовника
+int stripeFirstRow(struct GardenerOptions options, struct FieldDimensions field) {
+    int stripe = (options.id - 1) % options.gardeners;
+    return (int)((long)stripe * field.numRows / options.gardeners);
+}
+
+// Функция для построения маршрута садовника в виде прямых отрезков. Каждая стратегия
+// проходит все поле, уже обработанные участки садовник просто проходит.
+// Возвращает количество отрезков
+int buildRoute(struct GardenerOptions options, struct FieldDimensions field, struct Line *lines) {
+    int rows = field.numRows;
+    int cols = field.numCols;
+    int count = 0;
+
+    if (options.strategy == ROW_SNAKE) {
+        // Змейка по строкам от верхнего левого угла
+        for (int i = 0; i < rows; ++i) {
+            addLine(lines, &count, i, i % 2 == 0 ? 0 : cols - 1, cols, 0, i % 2 == 0 ? 1 : -1);
+        }
+    } else if (options.strategy == COLUMN_SNAKE) {
+        // Змейка по столбцам от нижнего правого угла
+        for (int k = 0; k < cols; ++k) {
+            addLine(lines, &count, k % 2 == 0 ? rows - 1 : 0, cols - 1 - k, rows,
+                    k % 2 == 0 ? -1 : 1, 0);
+        }
+    } else if (options.strategy == SPIRAL) {
+        // Спираль по часовой стрелке от верхнего левого угла к центру
+        int top = 0, bottom = rows - 1, left = 0, right = cols - 1;
+        while (top <= bottom && left <= right) {
+            addLine(lines, &count, top, left, right - left + 1, 0, 1);
+            addLine(lines, &count, top + 1, right, bottom - top, 1, 0);
+            if (top < bottom) {
+                addLine(lines, &count, bottom, right - 1, right - left, 0, -1);
+            }
+            if (left < right) {
+                addLine(lines, &count, bottom - 1, left, bottom - top - 1, -1, 0);
+            }
+            ++top;
+            --bottom;
+            ++left;
+            --right;
+        }
+    } else {
+        // Змейка по строкам, начиная со своей полосы: полосы строк поровну делятся между
+        // садовниками, после своей полосы садовник проходит остальные по кругу
+        int firstRow = stripeFirstRow(options, field);
+        for (int k = 0; k < rows; ++k) {
+            int i = (firstRow + k) % rows;
+            addLine(lines, &count, i, k % 2 == 0 ? 0 : cols - 1, cols, 0, k % 2 == 0 ? 1 : -1);
+        }
+    }
+
+    return count;
+}
+
+// Функция, которая выполняет задачи на поле по маршруту
+void processField(int clientSocket, struct GardenerOptions options, struct FieldDimensions field) {
+    struct Line *lines = malloc((2 * (field.numRows + field.numCols) + 4) * sizeof(struct Line));
+    if (lines == NULL) {
+        perror("Error allocating route");
+        exit(EXIT_FAILURE);
+    }
+    int lineCount = buildRoute(options, field, lines);
+
+    struct Task task;
+    task.worker_id = options.id;
+    task.duration = options.duration;
+    task.status = 0;
+
+    struct Pipeline pipeline = createPipeline(clientSocket, options.useBatches ? 1 : options.window);
+    for (int l = 0; l < lineCount; ++l) {
+        struct Line line = lines[l];
+        task.row = line.row;
+        task.col = line.col;
+
+        // В пакетном режиме отрезок маршрута отправляется частями не длиннее MAX_BATCH
+        while (options.useBatches && line.count > 0) {
+            struct Segment segment;
+            segment.count = line.count < MAX_BATCH ? line.count : MAX_BATCH;
+            segment.rowStep = line.rowStep;
+            segment.colStep = line.colStep;
+            sendSegmentAndAwaitResponse(clientSocket, task, segment);
+
+            task.row += segment.count * line.rowStep;
+            task.col += segment.count * line.colStep;
+            line.count -= segment.count;
+        }
+
+        for (int k = 0; k < line.count; ++k) {
+            submitTask(&pipeline, task);
+            task.row += line.rowStep;
+            task.col += line.colStep;
+        }
+    }
+    drainPipeline(&pipeline);
+    free(pipeline.tasks);
+    free(lines);
+
+    // Завершение работы
+    task.status = 1;
+    sendTaskAndAwaitResponse(clientSocket, task);
+}
+
+// Функция, которая проходит поле запросами "продвинь меня": сервер сам пропускает
+// необрабатываемые и обработанные участки, поэтому на каждый из них не нужен обмен с сервером
+void processFieldByAdvancing(int clientSocket, struct GardenerOptions options,
+                             struct FieldDimensions field) {
+    struct Task task;
+    task.row = 0;
+    task.col = 0;
+    task.worker_id = options.id;
+    task.duration = options.duration;
+    task.status = TASK_ADVANCE;
+
+    struct Route route;
+    route.strategy = options.strategy;
+    route.firstLine = options.strategy == STRIPE ? stripeFirstRow(options, field) : 0;
+    route.line = 0;
+    route.offset = 0;
+
+    while (1) {
+        char frame[sizeof(struct Task) + sizeof(struct Route)];
+        memcpy(frame, &task, sizeof(task));
+        memcpy(frame + sizeof(task), &route, sizeof(route));
+        if (send(clientSocket, frame, sizeof(frame), 0) != sizeof(frame)) {
+            perror("Error sending task");
+            exit(EXIT_FAILURE);
+        }
+
+        struct Position position;
+        receiveExactly(clientSocket, &position, sizeof(position));
+        if (position.line < 0) {
+            break;
+        }
+        printf("Gardener %d at row: %d, col: %d (skipped %d)\n", options.id, position.row,
+               position.col, position.skipped);
+        route.line = position.line;
+        route.offset = position.offset + 1;
+    }
+
+    // Завершение работы
+    task.status = 1;
+    sendTaskAndAwaitResponse(clientSocket, task);
+}
+
+// Функция для разбора необязательных параметров
+int parseGardenerOptions(int argc, char *argv[], struct GardenerOptions *options) {
+    options->strategy = options->id % 2 == 1 ? ROW_SNAKE : COLUMN_SNAKE;
+    options->gardeners = 1;
+    options->useBatches = 0;
+    options->window = 1;
+    options->advance = 0;
+
+    for (int i = 5; i < argc; ++i) {
+        if (strcmp(argv[i], "--strategy=row") == 0) {
+            options->strategy = ROW_SNAKE;
+        } else if (strcmp(argv[i], "--strategy=column") == 0) {
+            options->strategy = COLUMN_SNAKE;
+        } else if (strcmp(argv[i], "--strategy=spiral") == 0) {
+            options->strategy = SPIRAL;
+        } else if (strcmp(argv[i], "--strategy=stripe") == 0) {
+            options->strategy = STRIPE;
+        } else if (strcmp(argv[i], "--advance") == 0) {
+            options->advance = 1;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            options->useBatches = 1;
+        } else if (strncmp(argv[i], "--gardeners=", 12) == 0 &&
+                   (options->gardeners = atoi(argv[i] + 12)) > 0) {
+            continue;
+        } else if (strncmp(argv[i], "--window=", 9) != 0 ||
+                   (options->window = atoi(argv[i] + 9)) < 1) {
+            return -1;
+        }
+    }
+    options->window = options->window < MAX_WINDOW ? options->window : MAX_WINDOW;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    struct GardenerOptions options;
+
+    // Проверка аргументов командной строки
+    if (argc < 5 || (options.id = atoi(argv[4])) < 1 ||
+        parseGardenerOptions(argc, argv, &options) < 0) {
+        fprintf(stderr,
+                "Arguments: %s <server IP> <server port> <work time> <gardener id> "
+                "[--strategy=row|column|spiral|stripe] [--gardeners=N] "
+                "[--batch | --window=N | --advance]\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    options.duration = atoi(argv[3]);
+
+    // Инициализация клиентского сокета
+    int clientSocket = initializeClientSocket(argv[1], atoi(argv[2]));
+
+    // Получение размеров поля от сервера
+    struct FieldDimensions fieldSize;
+    receiveExactly(clientSocket, &fieldSize, sizeof(fieldSize));
+
+    // Выполнение работы на поле
+    if (options.advance) {
+        processFieldByAdvancing(clientSocket, options, fieldSize);
+    } else {
+        processField(clientSocket, options, fieldSize);
+    }
+
+    printf("Work is done (gardener %d)\n", options.id);
+    close(clientSocket);
+    return 0;
+}
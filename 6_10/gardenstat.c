@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Размеры гистограмм и таблицы участков по садовникам (как на сервере)
+#define METRICS_BUCKETS 40
+#define METRICS_GARDENERS 1024
+
+// Сколько самых активных садовников выводить за интервал
+#define TOP_GARDENERS 8
+
+// Гистограмма длительностей: в корзине k - длительности от 2^k до 2^(k+1) нс
+struct Histogram {
+    unsigned long long count;
+    unsigned long long sum_ns;
+    unsigned long long buckets[METRICS_BUCKETS];
+};
+
+// Метрики сервера в разделяемой памяти
+struct Metrics {
+    unsigned long long plots_visited;
+    unsigned long long plots_processed;
+    unsigned long long events_written;
+    unsigned long long events_dropped;
+    unsigned long long ring_occupancy;
+    unsigned long long ring_high_water;
+    unsigned long long gardeners_connected;
+    unsigned long long observers_connected;
+    unsigned long long plots_total;
+    unsigned long long snapshot_retries;
+    unsigned long long repaired_writes;
+    struct Histogram zone_wait;
+    struct Histogram plot_time;
+    struct Histogram recv_time;
+    struct Histogram send_time;
+    unsigned long long gardener_plots[METRICS_GARDENERS];
+};
+
+const char *metrics_shared_object = "/posix-metrics-shared-object";
+
+struct Metrics *attachMetrics() {
+    int shmid = shm_open(metrics_shared_object, O_RDONLY, 0);
+    if (shmid < 0) {
+        perror("Can't connect to shared memory (is the server running?)");
+        exit(EXIT_FAILURE);
+    }
+    struct Metrics *metrics = mmap(0, sizeof(struct Metrics), PROT_READ, MAP_SHARED, shmid, 0);
+    if (metrics == MAP_FAILED) {
+        perror("Can't connect to shared memory");
+        exit(EXIT_FAILURE);
+    }
+    close(shmid);
+    return metrics;
+}
+
+// Копия блока метрик. Счетчики читаются по одному без общей блокировки, поэтому между
+// счетчиками возможны расхождения в несколько единиц - для статистики этого достаточно
+void takeSample(const struct Metrics *metrics, struct Metrics *sample) {
+    const unsigned long long *from = (const unsigned long long *)metrics;
+    unsigned long long *to = (unsigned long long *)sample;
+    for (size_t i = 0; i < sizeof(struct Metrics) / sizeof(unsigned long long); ++i) {
+        to[i] = __atomic_load_n(from + i, __ATOMIC_RELAXED);
+    }
+}
+
+// Среднее и 99-й процентиль (верхняя граница корзины) за интервал, в микросекундах
+void printHistogram(const char *name, const struct Histogram *now, const struct Histogram *before) {
+    unsigned long long count = now->count - before->count;
+    if (count == 0) {
+        printf(" %s=-", name);
+        return;
+    }
+    double average = (double)(now->sum_ns - before->sum_ns) / count / 1000.0;
+    unsigned long long rank = count - count / 100;
+    unsigned long long seen = 0;
+    int bucket = 0;
+    for (; bucket < METRICS_BUCKETS - 1; ++bucket) {
+        seen += now->buckets[bucket] - before->buckets[bucket];
+        if (seen >= rank) {
+            break;
+        }
+    }
+    printf(" %s=%.1f/%.1fus", name, average, (double)(2ULL << bucket) / 1000.0);
+}
+
+void printGardeners(const struct Metrics *now, const struct Metrics *before, double seconds) {
+    int printed[TOP_GARDENERS];
+    int count = 0;
+    while (count < TOP_GARDENERS) {
+        int best = -1;
+        unsigned long long best_delta = 0;
+        for (int id = 0; id < METRICS_GARDENERS; ++id) {
+            unsigned long long delta = now->gardener_plots[id] - before->gardener_plots[id];
+            int taken = 0;
+            for (int k = 0; k < count; ++k) {
+                taken |= printed[k] == id;
+            }
+            if (!taken && delta > best_delta) {
+                best = id;
+                best_delta = delta;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        if (count == 0) {
+            printf("  gardeners:");
+        }
+        printf(" #%d=%.0f/s", best, best_delta / seconds);
+        printed[count++] = best;
+    }
+    if (count > 0) {
+        printf("\n");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 2) {
+        fprintf(stderr, "Arguments: %s [interval ms]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    int interval = argc == 2 ? atoi(argv[1]) : 1000;
+    if (interval <= 0) {
+        fprintf(stderr, "Interval should be positive\n");
+        exit(EXIT_FAILURE);
+    }
+    double seconds = interval / 1000.0;
+
+    struct Metrics *metrics = attachMetrics();
+    struct Metrics *before = malloc(sizeof(struct Metrics));
+    struct Metrics *now = malloc(sizeof(struct Metrics));
+    takeSample(metrics, before);
+
+    // Гистограммы выводятся как среднее/p99
+    while (1) {
+        usleep(interval * 1000);
+        takeSample(metrics, now);
+
+        printf("visited=%.0f/s processed=%.0f/s events=%.0f/s dropped=%.0f/s ring=%llu(max %llu)",
+               (now->plots_visited - before->plots_visited) / seconds,
+               (now->plots_processed - before->plots_processed) / seconds,
+               (now->events_written - before->events_written) / seconds,
+               (now->events_dropped - before->events_dropped) / seconds,
+               now->ring_occupancy, now->ring_high_water);
+        printf(" gardeners=%llu observers=%llu done=%.1f%% retries=%.0f/s",
+               now->gardeners_connected, now->observers_connected,
+               now->plots_total > 0 ? 100.0 * now->plots_processed / now->plots_total : 100.0,
+               (now->snapshot_retries - before->snapshot_retries) / seconds);
+        printHistogram("zone_wait", &now->zone_wait, &before->zone_wait);
+        printHistogram("plot", &now->plot_time, &before->plot_time);
+        printHistogram("recv", &now->recv_time, &before->recv_time);
+        printHistogram("send", &now->send_time, &before->send_time);
+        printf("\n");
+        printGardeners(now, before, seconds);
+        fflush(stdout);
+
+        struct Metrics *swap = before;
+        before = now;
+        now = swap;
+    }
+}
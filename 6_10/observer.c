@@ -5,6 +5,15 @@
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "tile_versions.h"
 
 // Структура, описывающая задачу
 struct Task {
@@ -26,11 +35,70 @@ enum EventType { MAP_EVENT, ACTION_EVENT, META_EVENT };
 
 // Структура, описывающая событие
 struct Event {
-    char timestamp[26];   // Временная метка
+    long long timestamp;  // Временная метка, нс
     char data[1024];      // Буфер данных
     enum EventType type;  // Тип события
 };
 
+// Типы сообщений от сервера: текст, полный снимок поля и изменение одной клетки
+enum MessageType { TEXT_MESSAGE, SNAPSHOT_MESSAGE, DELTA_MESSAGE };
+
+// Заголовок сообщения от сервера, за ним следует length байт данных
+struct MessageHeader {
+    int type;
+    unsigned int length;
+};
+
+// Запрос серверу прислать изменения после номера sequence (тот же заголовок MessageHeader)
+enum RequestType { RESYNC_REQUEST = 100 };
+
+struct ResyncRequest {
+    long long sequence;
+};
+
+// Начало снимка поля, за ним следуют rows * columns клеток, упакованных по bits_per_cell бит.
+// Код клетки - значение поля плюс один
+struct SnapshotHeader {
+    long long sequence;
+    int rows;
+    int columns;
+    int bits_per_cell;
+};
+
+// Изменение клетки поля с порядковым номером изменения
+struct Delta {
+    long long sequence;
+    int row;
+    int column;
+    int value;
+};
+
+// Общее состояние сервера в разделяемой памяти (как на сервере). generation меняется после
+// каждого изменения поля, watchers - число локальных наблюдателей, ждущих на generation
+struct SharedState {
+    long long sequence;
+    int generation;
+    int watchers;
+    int rows;
+    int columns;
+};
+
+const char *shared_object = "/posix-shared-object";
+const char *state_shared_object = "/posix-state-shared-object";
+const char *versions_shared_object = "/posix-versions-shared-object";
+
+// Локальный наблюдатель выводит поле не чаще раза в LOCAL_INTERVAL мс
+#define LOCAL_INTERVAL 100
+
+// Поле выводится целиком после каждого изменения, только если оно не больше этого
+#define MAP_PRINT_LIMIT 400
+
+// Изменения могут прийти не по порядку номеров, поэтому пропуск считается потерей, только
+// если после него пришло RESYNC_GAP более новых изменений. Пришедшие изменения отмечаются
+// в окне из RESYNC_WINDOW номеров после последнего непрерывного
+#define RESYNC_GAP 256
+#define RESYNC_WINDOW 4096
+
 // Структура для описания наблюдателя
 struct Observer {
     int socket;
@@ -86,19 +154,288 @@ void sendTask(int sock, struct Task task) {
 }
 
 // Глобальный клиентский сокет
-int client_socket;
+int client_socket = -1;
+
+// Собственная копия поля, которая поддерживается по снимку и изменениям
+int *field = NULL;
+int field_rows = 0;
+int field_columns = 0;
+long long last_sequence = 0;
+
+// Все изменения до applied_sequence включительно получены (или вошли в снимок)
+long long applied_sequence = 0;
+char received_after[RESYNC_WINDOW];
+int resync_requested = 0;
+long long resync_target = 0;  // последнее изменение, известное на момент запроса
 
 // Обработчик сигнала прерывания (Ctrl+C)
 void signalHandler(int sig) {
-    printf("Observer stopped\n");
+    printf("Observer stopped at change %lld\n", applied_sequence);
     close(client_socket);
     exit(EXIT_SUCCESS);
 }
 
+// Чтение ровно size байт; при закрытии соединения сервером наблюдатель завершается
+void receiveExactly(int sock, void *buffer, unsigned int size) {
+    unsigned int received = 0;
+    while (received < size) {
+        int bytes = recv(sock, (char *)buffer + received, size - received, 0);
+        if (bytes < 0) {
+            perror("Receiving failed");
+            close(sock);
+            exit(EXIT_FAILURE);
+        }
+
+        if (bytes == 0) {
+            printf("Server connection closed...\n");
+            close(sock);
+            exit(EXIT_SUCCESS);
+        }
+        received += bytes;
+    }
+}
+
+// Ширина столбца карты - число цифр в наибольшем номере садовника
+void printField() {
+    int max_value = 0;
+    for (long k = 0; k < (long)field_rows * field_columns; ++k) {
+        if (field[k] > max_value) {
+            max_value = field[k];
+        }
+    }
+    int width = snprintf(NULL, 0, "%d", max_value);
+
+    printf("\n");
+    for (int i = 0; i < field_rows; ++i) {
+        for (int j = 0; j < field_columns; ++j) {
+            if (field[i * field_columns + j] < 0) {
+                printf("%*s ", width, "X");
+            } else {
+                printf("%*d ", width, field[i * field_columns + j]);
+            }
+        }
+        printf("\n");
+    }
+    printf("\n");
+}
+
+// Распаковка снимка в копию поля
+void unpackField(const unsigned char *packed, long cells, int bits) {
+    for (long k = 0; k < cells; ++k) {
+        int code;
+        if (bits == 2) {
+            code = (packed[k / 4] >> (k % 4 * 2)) & 3;
+        } else if (bits == 8) {
+            code = packed[k];
+        } else {
+            code = (int)((const unsigned int *)packed)[k];
+        }
+        field[k] = code - 1;
+    }
+}
+
+// Прием снимка поля: копия поля создается заново
+void receiveSnapshot(struct MessageHeader header) {
+    struct SnapshotHeader snapshot;
+    receiveExactly(client_socket, &snapshot, sizeof(snapshot));
+
+    free(field);
+    field_rows = snapshot.rows;
+    field_columns = snapshot.columns;
+    if ((field = malloc((size_t)field_rows * field_columns * sizeof(int))) == NULL) {
+        perror("Error: Unable to allocate field");
+        exit(EXIT_FAILURE);
+    }
+    unsigned int packed_size = header.length - sizeof(snapshot);
+    unsigned char *packed = malloc(packed_size);
+    if (packed == NULL) {
+        perror("Error: Unable to allocate snapshot");
+        exit(EXIT_FAILURE);
+    }
+    receiveExactly(client_socket, packed, packed_size);
+    unpackField(packed, (long)field_rows * field_columns, snapshot.bits_per_cell);
+    free(packed);
+    last_sequence = snapshot.sequence;
+    applied_sequence = snapshot.sequence;
+    memset(received_after, 0, sizeof(received_after));
+    resync_requested = 0;
+
+    if ((long)field_rows * field_columns <= MAP_PRINT_LIMIT) {
+        printField();
+    } else {
+        printf("Snapshot %dx%d at change %lld\n", field_rows, field_columns, last_sequence);
+    }
+}
+
+void requestResync() {
+    struct {
+        struct MessageHeader header;
+        struct ResyncRequest request;
+    } message;
+    message.header.type = RESYNC_REQUEST;
+    message.header.length = sizeof(message.request);
+    message.request.sequence = applied_sequence;
+    if (send(client_socket, &message, sizeof(message), MSG_NOSIGNAL) != sizeof(message)) {
+        perror("Unable to request resync");
+        return;
+    }
+    resync_requested = 1;
+    resync_target = last_sequence;
+    printf("Requested changes after %lld\n", applied_sequence);
+}
+
+// Учет номера изменения: продвижение непрерывной части и запрос пропущенного
+void trackSequence(long long sequence) {
+    if (sequence <= applied_sequence) {
+        return;
+    }
+    if (sequence - applied_sequence < RESYNC_WINDOW) {
+        received_after[sequence % RESYNC_WINDOW] = 1;
+    }
+    while (received_after[(applied_sequence + 1) % RESYNC_WINDOW]) {
+        applied_sequence++;
+        received_after[applied_sequence % RESYNC_WINDOW] = 0;
+    }
+    // Новый запрос - после того, как ответ на предыдущий закрыл пропуск, или если ответ
+    // тоже потерялся и пропуск отстал от новых изменений на целое окно
+    if (resync_requested && (applied_sequence >= resync_target ||
+                             last_sequence - resync_target > RESYNC_WINDOW)) {
+        resync_requested = 0;
+    }
+    if (!resync_requested && last_sequence - applied_sequence > RESYNC_GAP) {
+        requestResync();
+    }
+}
+
+// Применение изменения одной клетки к копии поля
+void applyDelta(struct Delta delta) {
+    if (field == NULL || delta.row < 0 || delta.column < 0 || delta.row >= field_rows ||
+        delta.column >= field_columns) {
+        return;
+    }
+
+    field[delta.row * field_columns + delta.column] = delta.value;
+    if (delta.sequence > last_sequence) {
+        last_sequence = delta.sequence;
+    }
+    trackSequence(delta.sequence);
+
+    if ((long)field_rows * field_columns <= MAP_PRINT_LIMIT) {
+        printField();
+    } else {
+        printf("Plot row: %d, col: %d processed by gardener %d\n", delta.row, delta.column,
+               delta.value);
+    }
+}
+
+// Отображение разделяемой памяти сервера по имени объекта
+void *attachSharedObject(const char *name, size_t size, int protection) {
+    int shmid = shm_open(name, protection & PROT_WRITE ? O_RDWR : O_RDONLY, 0);
+    if (shmid < 0) {
+        perror("Can't connect to shared memory (is the server running?)");
+        exit(EXIT_FAILURE);
+    }
+    void *memory = mmap(0, size, protection, MAP_SHARED, shmid, 0);
+    if (memory == MAP_FAILED) {
+        perror("Can't connect to shared memory");
+        exit(EXIT_FAILURE);
+    }
+    close(shmid);
+    return memory;
+}
+
+// Сервер удаляет разделяемую память при остановке, поэтому ее исчезновение значит,
+// что сервер остановлен (уже отображенная память остается доступной)
+int serverStopped() {
+    int shmid = shm_open(state_shared_object, O_RDONLY, 0);
+    if (shmid < 0) {
+        return errno == ENOENT;
+    }
+    close(shmid);
+    return 0;
+}
+
+// Копия поля по участкам (copyTile из tile_versions.h)
+void copyField(const int *shared_field, const struct TileVersion *versions, long cells) {
+    for (long first = 0; first < cells; first += TILE_CELLS) {
+        long part = cells - first < TILE_CELLS ? cells - first : TILE_CELLS;
+        copyTile(field + first, shared_field + first, versions + first / TILE_CELLS, part);
+    }
+}
+
+// Ожидание изменения generation, не дольше секунды
+void waitGeneration(struct SharedState *state, int seen) {
+    struct timespec timeout = {1, 0};
+    __atomic_add_fetch(&state->watchers, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &state->generation, FUTEX_WAIT, seen, &timeout, NULL, 0);
+    __atomic_sub_fetch(&state->watchers, 1, __ATOMIC_SEQ_CST);
+}
+
+// Локальный режим: поле читается прямо из разделяемой памяти сервера, без сокета. Копия
+// снимается после изменения generation, но не чаще раза в interval мс, поэтому при любом
+// числе изменений наблюдатель стоит серверу одного futex-пробуждения на изменение
+void watchLocalField(int interval) {
+    struct SharedState *state =
+        attachSharedObject(state_shared_object, sizeof(struct SharedState), PROT_READ | PROT_WRITE);
+    field_rows = state->rows;
+    field_columns = state->columns;
+    if (field_rows <= 0 || field_columns <= 0) {
+        fprintf(stderr, "Server has not created the field yet\n");
+        exit(EXIT_FAILURE);
+    }
+    long cells = (long)field_rows * field_columns;
+    const int *shared_field = attachSharedObject(shared_object, cells * sizeof(int), PROT_READ);
+    const struct TileVersion *versions = attachSharedObject(
+        versions_shared_object,
+        (cells + TILE_CELLS - 1) / TILE_CELLS * sizeof(struct TileVersion), PROT_READ);
+    field = malloc(cells * sizeof(int));
+
+    int seen = __atomic_load_n(&state->generation, __ATOMIC_ACQUIRE) - 1;
+    while (1) {
+        int generation = __atomic_load_n(&state->generation, __ATOMIC_ACQUIRE);
+        if (generation == seen) {
+            waitGeneration(state, seen);
+            if (__atomic_load_n(&state->generation, __ATOMIC_ACQUIRE) == seen && serverStopped()) {
+                printf("Server stopped\n");
+                exit(EXIT_SUCCESS);
+            }
+            continue;
+        }
+
+        seen = generation;
+        applied_sequence = __atomic_load_n(&state->sequence, __ATOMIC_ACQUIRE);
+        copyField(shared_field, versions, cells);
+        long processed = 0;
+        long total = 0;
+        for (long k = 0; k < cells; ++k) {
+            processed += field[k] > 0;
+            total += field[k] >= 0;
+        }
+        if (cells <= MAP_PRINT_LIMIT) {
+            printField();
+        }
+        printf("Change %lld: processed %ld of %ld plots (%.1f%%)\n", applied_sequence, processed,
+               total, total > 0 ? 100.0 * processed / total : 100.0);
+        fflush(stdout);
+        usleep(interval * 1000);
+    }
+}
+
 // Главная функция
 int main(int argc, char *argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "--local") == 0) {
+        int interval = LOCAL_INTERVAL;
+        if (argc > 3 || (argc == 3 && (strncmp(argv[2], "--interval=", 11) != 0 ||
+                                       (interval = atoi(argv[2] + 11)) <= 0))) {
+            fprintf(stderr, "Arguments: %s --local [--interval=MS]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        signal(SIGINT, signalHandler);
+        watchLocalField(interval);
+    }
     if (argc != 3) {
-        fprintf(stderr, "Arguments: %s <server IP> <observer port>\n", argv[0]);
+        fprintf(stderr, "Arguments: %s <server IP> <observer port> | --local [--interval=MS]\n",
+                argv[0]);
         exit(EXIT_FAILURE);
     }
 
@@ -110,25 +447,32 @@ int main(int argc, char *argv[]) {
     signal(SIGINT, signalHandler);
 
     while (1) {
-        char buffer[1024];
-        int bytes_received = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
-        if (bytes_received < 0) {
-            perror("Receiving failed");
-            close(client_socket);
-            exit(EXIT_FAILURE);
-        }
+        struct MessageHeader header;
+        receiveExactly(client_socket, &header, sizeof(header));
 
-        if (bytes_received == 0) {
-            printf("Server connection closed...\n");
-            close(client_socket);
-            exit(EXIT_SUCCESS);
+        if (header.type == SNAPSHOT_MESSAGE) {
+            receiveSnapshot(header);
+        } else if (header.type == DELTA_MESSAGE && header.length == sizeof(struct Delta)) {
+            struct Delta delta;
+            receiveExactly(client_socket, &delta, sizeof(delta));
+            applyDelta(delta);
+        } else {
+            // Текстовые сообщения (и неизвестные типы) выводятся как есть
+            char buffer[1024];
+            unsigned int left = header.length;
+            while (left > 0) {
+                unsigned int part = left < sizeof(buffer) - 1 ? left : sizeof(buffer) - 1;
+                receiveExactly(client_socket, buffer, part);
+                buffer[part] = '\0';
+                if (header.type == TEXT_MESSAGE) {
+                    printf("%s", buffer);
+                }
+                left -= part;
+            }
         }
-
-        buffer[bytes_received] = '\0';
-        printf("%s", buffer);
+        fflush(stdout);
     }
 
     close(client_socket);
     return 0;
 }
-
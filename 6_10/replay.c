@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Формат журнала (как на сервере)
+#define JOURNAL_MAGIC "GARDENJ1"
+#define JOURNAL_VERSION 1
+
+// Поле больше этого числа клеток без --print не выводится
+#define PRINT_LIMIT 400
+
+enum journal_type { JOURNAL_NONE, JOURNAL_CONNECT, JOURNAL_MOVE, JOURNAL_CLAIM, JOURNAL_FINISH };
+
+struct JournalHeader {
+    char magic[8];
+    int version;
+    int header_size;
+    int rows;
+    int columns;
+    long long started_at;
+};
+
+struct JournalRecord {
+    long long timestamp;
+    unsigned short type;
+    unsigned short length;
+    int gardener_id;
+};
+
+struct JournalPlot {
+    int row;
+    int column;
+};
+
+// Итоги садовника к выбранному моменту
+struct GardenerSummary {
+    long long moves;
+    long long plots;
+    int finished;  // 1 - закончил работу, 2 - соединение потеряно
+};
+
+struct GardenerSummary *gardeners = NULL;
+int gardeners_capacity = 0;
+
+struct GardenerSummary *getGardener(int id) {
+    if (id >= gardeners_capacity) {
+        int capacity = gardeners_capacity > 0 ? gardeners_capacity : 16;
+        while (capacity <= id) {
+            capacity *= 2;
+        }
+        gardeners = realloc(gardeners, capacity * sizeof(struct GardenerSummary));
+        memset(gardeners + gardeners_capacity, 0,
+               (capacity - gardeners_capacity) * sizeof(struct GardenerSummary));
+        gardeners_capacity = capacity;
+    }
+    return gardeners + id;
+}
+
+const char *mapJournal(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Unable to open journal");
+        exit(EXIT_FAILURE);
+    }
+    struct stat status;
+    if (fstat(fd, &status) < 0) {
+        perror("Unable to read journal size");
+        exit(EXIT_FAILURE);
+    }
+    *size = status.st_size;
+    if (*size < sizeof(struct JournalHeader)) {
+        fprintf(stderr, "Journal is too short\n");
+        exit(EXIT_FAILURE);
+    }
+    const char *journal = mmap(0, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (journal == MAP_FAILED) {
+        perror("Unable to map journal");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    // Журнал читается один раз от начала до конца
+    madvise((void *)journal, *size, MADV_SEQUENTIAL);
+    return journal;
+}
+
+void printField(const int *field, int columns, int rows) {
+    int max_value = 0;
+    for (long k = 0; k < (long)rows * columns; ++k) {
+        max_value = field[k] > max_value ? field[k] : max_value;
+    }
+    int width = snprintf(NULL, 0, "%d", max_value);
+    for (int i = 0; i < rows; ++i) {
+        for (int j = 0; j < columns; ++j) {
+            if (field[i * columns + j] < 0) {
+                printf("%*s ", width, "X");
+            } else {
+                printf("%*d ", width, field[i * columns + j]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    long long at = -1;
+    int print = 0;
+    if (argc < 2) {
+        fprintf(stderr, "Arguments: %s <journal> [--at=SECONDS] [--print]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 2; i < argc; ++i) {
+        if (strncmp(argv[i], "--at=", 5) == 0 && argv[i][5] != '\0') {
+            at = (long long)(atof(argv[i] + 5) * 1e9);
+        } else if (strcmp(argv[i], "--print") == 0) {
+            print = 1;
+        } else {
+            fprintf(stderr, "Arguments: %s <journal> [--at=SECONDS] [--print]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    size_t size;
+    const char *journal = mapJournal(argv[1], &size);
+    struct JournalHeader header;
+    memcpy(&header, journal, sizeof(header));
+    if (memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != JOURNAL_VERSION || header.header_size < (int)sizeof(header) ||
+        header.rows <= 0 || header.columns <= 0) {
+        fprintf(stderr, "Not a gardener journal\n");
+        exit(EXIT_FAILURE);
+    }
+    long cells = (long)header.rows * header.columns;
+    size_t offset = header.header_size + cells;
+    if (offset > size) {
+        fprintf(stderr, "Journal is too short\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Начальное поле: необрабатываемые клетки -1, свободные 0
+    int *field = malloc(cells * sizeof(int));
+    long plots_total = 0;
+    for (long k = 0; k < cells; ++k) {
+        field[k] = journal[header.header_size + k] ? 0 : -1;
+        plots_total += field[k] == 0;
+    }
+
+    // Записи идут в порядке чтения из кольца событий, время в соседних записях может немного
+    // убывать, поэтому журнал просматривается до конца, а не до первой записи позже момента
+    long long records = 0;
+    long long applied = 0;
+    long long counts[JOURNAL_FINISH + 1] = {0};
+    long long last_timestamp = 0;
+    long plots_processed = 0;
+    int truncated = 0;
+    while (offset + sizeof(struct JournalRecord) <= size) {
+        struct JournalRecord record;
+        memcpy(&record, journal + offset, sizeof(record));
+        if (offset + sizeof(record) + record.length > size) {
+            truncated = 1;
+            break;
+        }
+        struct JournalPlot plot;
+        memset(&plot, 0, sizeof(plot));
+        memcpy(&plot, journal + offset + sizeof(record),
+               record.length < sizeof(plot) ? record.length : sizeof(plot));
+        offset += sizeof(record) + record.length;
+        ++records;
+        last_timestamp = record.timestamp > last_timestamp ? record.timestamp : last_timestamp;
+
+        if ((at >= 0 && record.timestamp > at) || record.type > JOURNAL_FINISH ||
+            record.gardener_id < 0) {
+            continue;
+        }
+        ++applied;
+        ++counts[record.type];
+        if (record.type == JOURNAL_MOVE) {
+            ++getGardener(record.gardener_id)->moves;
+        } else if (record.type == JOURNAL_CLAIM && plot.row >= 0 && plot.row < header.rows &&
+                   plot.column >= 0 && plot.column < header.columns) {
+            int *cell = field + (long)plot.row * header.columns + plot.column;
+            plots_processed += *cell == 0;
+            *cell = record.gardener_id;
+            ++getGardener(record.gardener_id)->plots;
+        } else if (record.type == JOURNAL_FINISH) {
+            getGardener(record.gardener_id)->finished = plot.row ? 2 : 1;
+        }
+    }
+
+    struct timespec finished;
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    double elapsed = (finished.tv_sec - started.tv_sec) +
+                     (finished.tv_nsec - started.tv_nsec) / 1e9;
+
+    time_t started_at = header.started_at / 1000000000LL;
+    char started_text[64];
+    strftime(started_text, sizeof(started_text), "%Y-%m-%d %H:%M:%S", localtime(&started_at));
+    printf("Journal %s: field %dx%d, started %s, %lld records over %.3f s%s\n", argv[1],
+           header.rows, header.columns, started_text, records, last_timestamp / 1e9,
+           truncated ? " (last record truncated)" : "");
+    printf("At %.3f s: processed %ld of %ld plots (%.1f%%), connects=%lld moves=%lld "
+           "claims=%lld finishes=%lld\n",
+           (at >= 0 ? at : last_timestamp) / 1e9, plots_processed, plots_total,
+           plots_total > 0 ? 100.0 * plots_processed / plots_total : 100.0,
+           counts[JOURNAL_CONNECT], counts[JOURNAL_MOVE], counts[JOURNAL_CLAIM],
+           counts[JOURNAL_FINISH]);
+    for (int id = 0; id < gardeners_capacity; ++id) {
+        struct GardenerSummary *gardener = gardeners + id;
+        if (gardener->moves == 0 && gardener->plots == 0 && gardener->finished == 0) {
+            continue;
+        }
+        const char *state[] = {"working", "finished", "lost connection"};
+        printf("  gardener %d: moves=%lld plots=%lld %s\n", id, gardener->moves, gardener->plots,
+               state[gardener->finished]);
+    }
+    if (print || cells <= PRINT_LIMIT) {
+        printField(field, header.columns, header.rows);
+    }
+    printf("Replayed %lld of %lld records in %.3f ms (%.0f records/s)\n", applied, records,
+           elapsed * 1000.0, elapsed > 0 ? records / elapsed : 0.0);
+    return 0;
+}
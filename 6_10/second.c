@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <netinet/tcp.h>
 
 // Описание задачи
 struct Task {
@@ -14,6 +15,31 @@ struct Task {
     int status;
 };
 
+// Описание отрезка участков для пакетной отправки
+struct Segment {
+    int count;
+    int step_i;
+    int step_j;
+};
+
+// Конвейер неподтвержденных задач
+struct Pipeline {
+    int sockfd;
+    int window;
+    int head;
+    int count;
+    struct Task *tasks;
+};
+
+// Статус пакетной задачи и максимальный размер пакета
+#define TASK_BATCH 2
+#define MAX_BATCH 1024
+
+// Наибольшее окно конвейера. Клиент отправляет все задачи окна, не читая ответов, поэтому
+// ответы на окно (по 20 байт) должны помещаться в минимальный буфер сокета (4 КБ): иначе
+// клиент и сервер могут заблокироваться в send друг на друге. Большее --window уменьшается
+#define MAX_WINDOW 128
+
 // Описание размера поля
 struct FieldSize {
     int rows;
@@ -25,7 +51,7 @@ enum event_type { MAP, ACTION, META_INFO };
 
 // Описание события
 struct Event {
-    char timestamp[26];
+    long long timestamp;
     char buffer[1024];
     enum event_type type;
 };
@@ -76,8 +102,130 @@ void processTask(int sockfd, struct Task *task) {
     }
 }
 
+// Отправка отрезка участков одним кадром и получение вектора результатов
+void processSegment(int sockfd, struct Task *task, struct Segment *segment) {
+    struct Task header = *task;
+    header.status = TASK_BATCH;
+
+    char frame[sizeof(struct Task) + sizeof(struct Segment)];
+    memcpy(frame, &header, sizeof(header));
+    memcpy(frame + sizeof(header), segment, sizeof(*segment));
+    if (send(sockfd, frame, sizeof(frame), 0) != sizeof(frame)) {
+        perror("Send failed");
+        exit(EXIT_FAILURE);
+    }
+
+    int results[MAX_BATCH + 1];
+    int expected = (segment->count + 1) * sizeof(int);
+    int received = 0;
+    while (received < expected) {
+        int bytes = recv(sockfd, (char *)results + received, expected - received, 0);
+        if (bytes <= 0) {
+            perror("Receive failed");
+            exit(EXIT_FAILURE);
+        }
+        received += bytes;
+    }
+
+    for (int k = 0; k < results[0]; ++k) {
+        printf("Gardener %d at row: %d, col: %d\n", task->gardener_id,
+               task->plot_i + k * segment->step_i, task->plot_j + k * segment->step_j);
+    }
+}
+
+// Проход столбца пакетами не длиннее MAX_BATCH
+void processColumn(int sockfd, struct Task task, int length, int step_i) {
+    while (length > 0) {
+        struct Segment segment = { .count = length < MAX_BATCH ? length : MAX_BATCH,
+                                   .step_i = step_i,
+                                   .step_j = 0 };
+        processSegment(sockfd, &task, &segment);
+
+        task.plot_i += segment.count * step_i;
+        length -= segment.count;
+    }
+}
+
+// Выполнение задач на поле пакетами по столбцам
+void performWorkInBatches(int sockfd, int duration, struct FieldSize size) {
+    struct Task task = { .gardener_id = 2, .working_time = duration, .status = 0 };
+
+    // Обход поля змейкой снизу вверх, каждый столбец отправляется целиком
+    for (int j = size.columns - 1, k = 0; j >= 0; --j, ++k) {
+        task.plot_j = j;
+        if (k % 2 == 0) {
+            task.plot_i = size.rows - 1;
+            processColumn(sockfd, task, size.rows, -1);
+        } else {
+            task.plot_i = 0;
+            processColumn(sockfd, task, size.rows, 1);
+        }
+    }
+
+    // Завершение работы
+    task.status = 1;
+    processTask(sockfd, &task);
+}
+
+// Создание конвейера с окном из window задач
+void initializePipeline(struct Pipeline *pipeline, int sockfd, int window) {
+    pipeline->sockfd = sockfd;
+    pipeline->window = window;
+    pipeline->head = 0;
+    pipeline->count = 0;
+    if ((pipeline->tasks = malloc(window * sizeof(struct Task))) == NULL) {
+        perror("Pipeline allocation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    if (window > 1) {
+        int no_delay = 1;
+        setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    }
+}
+
+// Ожидание подтверждения самой старой задачи
+void awaitOldest(struct Pipeline *pipeline) {
+    int response;
+    int received = 0;
+    while (received < (int)sizeof(response)) {
+        int bytes = recv(pipeline->sockfd, (char *)&response + received,
+                         sizeof(response) - received, 0);
+        if (bytes <= 0) {
+            perror("Receive failed");
+            exit(EXIT_FAILURE);
+        }
+        received += bytes;
+    }
+
+    struct Task *task = pipeline->tasks + pipeline->head;
+    printf("Gardener %d at row: %d, col: %d\n", task->gardener_id, task->plot_i, task->plot_j);
+
+    pipeline->head = (pipeline->head + 1) % pipeline->window;
+    --pipeline->count;
+}
+
+// Отправка задачи без ожидания ответа, пока окно не заполнено
+void submitTask(struct Pipeline *pipeline, struct Task *task) {
+    if (pipeline->window <= 1) {
+        processTask(pipeline->sockfd, task);
+        return;
+    }
+
+    if (pipeline->count == pipeline->window) {
+        awaitOldest(pipeline);
+    }
+
+    if (send(pipeline->sockfd, task, sizeof(*task), 0) != sizeof(*task)) {
+        perror("Send failed");
+        exit(EXIT_FAILURE);
+    }
+    pipeline->tasks[(pipeline->head + pipeline->count) % pipeline->window] = *task;
+    ++pipeline->count;
+}
+
 // Выполнение задач на поле
-void performWork(int sockfd, int duration, struct FieldSize size) {
+void performWork(struct Pipeline *pipeline, int duration, struct FieldSize size) {
     struct Task task = { .gardener_id = 2, .working_time = duration, .status = 0 };
     int i = size.rows - 1, j = size.columns - 1;
 
@@ -86,17 +234,18 @@ void performWork(int sockfd, int duration, struct FieldSize size) {
         while (i >= 0) {
             task.plot_i = i;
             task.plot_j = j;
-            processTask(sockfd, &task);
+            submitTask(pipeline, &task);
             --i;
         }
 
         --j;
         ++i;
 
-        while (i < size.rows) {
+        // При нечетном числе столбцов обратного прохода в последнем столбце нет
+        while (j >= 0 && i < size.rows) {
             task.plot_i = i;
             task.plot_j = j;
-            processTask(sockfd, &task);
+            submitTask(pipeline, &task);
             ++i;
         }
 
@@ -104,14 +253,31 @@ void performWork(int sockfd, int duration, struct FieldSize size) {
         --j;
     }
 
+    while (pipeline->count > 0) {
+        awaitOldest(pipeline);
+    }
+
     // Завершение работы
     task.status = 1;
-    processTask(sockfd, &task);
+    processTask(pipeline->sockfd, &task);
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 4) {
-        fprintf(stderr, "Arguments: %s <server IP> <server port> <work time>\n", argv[0]);
+    int use_batches = 0;
+    int window = 1;
+    int valid_args = argc == 4 || argc == 5;
+    if (argc == 5) {
+        if (strcmp(argv[4], "--batch") == 0) {
+            use_batches = 1;
+        } else if (strncmp(argv[4], "--window=", 9) != 0 || (window = atoi(argv[4] + 9)) < 1) {
+            valid_args = 0;
+        }
+    }
+    window = window < MAX_WINDOW ? window : MAX_WINDOW;
+    if (!valid_args) {
+        fprintf(stderr,
+                "Arguments: %s <server IP> <server port> <work time> [--batch | --window=N]\n",
+                argv[0]);
         exit(EXIT_FAILURE);
     }
 
@@ -129,7 +295,14 @@ int main(int argc, char *argv[]) {
     }
 
     // Выполнение работы
-    performWork(sockfd, work_time, fieldSize);
+    if (use_batches) {
+        performWorkInBatches(sockfd, work_time, fieldSize);
+    } else {
+        struct Pipeline pipeline;
+        initializePipeline(&pipeline, sockfd, window);
+        performWork(&pipeline, work_time, fieldSize);
+        free(pipeline.tasks);
+    }
 
     printf("Work is done (2nd gardener)\n");
     close(sockfd);
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <string.h>
@@ -13,6 +14,34 @@
 #include <semaphore.h>
 #include <time.h>
 #include <pthread.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/resource.h>
+
+#include "tile_versions.h"
+
+// Размеры гистограмм и таблицы участков по садовникам в метриках
+#define METRICS_BUCKETS 40
+#define METRICS_GARDENERS 1024
+// Дольше этого поток метрик не ждет запрос и отправку ответа одному клиенту, в мс
+#define METRICS_TIMEOUT_MS 1000
+
+// Садовники с большими номерами учитываются в матрице ожиданий вместе с последним
+#define CONTENTION_GARDENERS 64
+
+// Сколько последних изменений клеток сервер хранит для повторной отправки наблюдателям
+#define DELTA_HISTORY 65536
+
+// Количество ячеек кольца событий (степень двойки)
+#define EVENT_RING_SIZE 4096
 
 // Описание задачи
 struct Task {
@@ -30,27 +59,336 @@ struct FieldSize {
 };
 
 // Типы событий
-enum event_type { MAP, ACTION, META_INFO, S_INFO };
+// MAP_CHUNK - часть карты, за которой следуют другие части; последняя часть имеет тип MAP.
+// DELTA - изменение одной клетки поля.
+// S_CONSOLE - как S_INFO, но только для консоли сервера: подключения наблюдателей не рассылаются
+// всем остальным наблюдателям, иначе при тысячах наблюдателей их подключение стоит O(N^2)
+// STOP - последнее событие при остановке сервера: writer завершается на нем
+enum event_type { MAP, ACTION, META_INFO, S_INFO, MAP_CHUNK, DELTA, S_CONSOLE, STOP };
+
+// Изменение клетки поля с порядковым номером изменения
+struct Delta {
+    long long sequence;
+    int row;
+    int column;
+    int value;
+};
+
+// Типы записей журнала: подключение садовника, переход на клетку, обработка клетки и
+// окончание работы. JOURNAL_NONE - событие в журнал не попадает
+enum journal_type { JOURNAL_NONE, JOURNAL_CONNECT, JOURNAL_MOVE, JOURNAL_CLAIM, JOURNAL_FINISH };
+
+// Данные события для журнала. Для JOURNAL_CONNECT садовник еще неизвестен, вместо клетки
+// записываются адрес и порт клиента, для JOURNAL_FINISH в row - признак потери соединения
+struct JournalData {
+    enum journal_type type;
+    int gardener_id;
+    int row;
+    int column;
+};
 
 // Описание события
 struct Event {
-    char timestamp[26];
+    long long timestamp;  // нс от запуска сервера (CLOCK_MONOTONIC)
     char buffer[1024];
     enum event_type type;
+    struct Delta delta;
+    struct JournalData journal;
+};
+
+// Журнал: заголовок, затем rows * columns байт начального поля (0 - необрабатываемая клетка,
+// 1 - свободная), затем записи. Числа записываются в порядке байтов сервера
+#define JOURNAL_MAGIC "GARDENJ1"
+#define JOURNAL_VERSION 1
+#define JOURNAL_BUFFER (1 << 16)
+
+struct JournalHeader {
+    char magic[8];
+    int version;
+    int header_size;
+    int rows;
+    int columns;
+    long long started_at;  // CLOCK_REALTIME запуска сервера, нс
+};
+
+// Заголовок записи, за ним length байт данных: JournalPlot для CONNECT, MOVE, CLAIM и FINISH
+struct JournalRecord {
+    long long timestamp;  // нс от запуска сервера, как у событий
+    unsigned short type;
+    unsigned short length;
+    int gardener_id;
+};
+
+struct JournalPlot {
+    int row;
+    int column;
+};
+
+// Ячейка кольца событий. sequence равен номеру записи, когда ячейка свободна для нее,
+// и номеру записи плюс один, когда событие записано и ждет чтения
+struct EventSlot {
+    unsigned int sequence;
+    struct Event event;
+};
+
+// Кольцо событий в разделяемой памяти: много писателей (процессы и потоки садовников),
+// один читатель (поток writer). Писатель получает номер записи атомарным сложением head
+// и копирует событие в ячейку, системный вызов нужен, только если кто-то спит на futex
+struct EventRing {
+    unsigned int head;
+    unsigned int tail;
+    int reader_sleeping;
+    int writers_sleeping;
+    struct EventSlot slots[EVENT_RING_SIZE];
+};
+
+// Типы сообщений наблюдателям: текст, полный снимок поля и изменение одной клетки
+enum message_type { TEXT_MESSAGE, SNAPSHOT_MESSAGE, DELTA_MESSAGE };
+
+// Заголовок сообщения наблюдателю, за ним следует length байт данных
+struct MessageHeader {
+    int type;
+    unsigned int length;
+};
+
+// Запросы наблюдателя серверу (тот же заголовок MessageHeader). RESYNC_REQUEST просит
+// прислать все изменения после номера sequence, которые наблюдатель пропустил
+enum request_type { RESYNC_REQUEST = 100 };
+
+struct ResyncRequest {
+    long long sequence;
+};
+
+// Начало снимка поля, за ним следуют rows * columns клеток, упакованных по bits_per_cell бит
+// (2, 8 или 32) в порядке строк. Код клетки - значение поля плюс один: 0 - необрабатываемая,
+// 1 - не обработана, k + 1 - обработана садовником k. В байте младшие биты - первая клетка
+struct SnapshotHeader {
+    long long sequence;
+    int rows;
+    int columns;
+    int bits_per_cell;
+};
+
+// Общее для всех процессов сервера состояние
+// Локальные наблюдатели (observer --local) читают поле прямо из разделяемой памяти: generation
+// увеличивается после каждого изменения поля, наблюдатели ждут его изменения на futex.
+// watchers - число ждущих, без них сервер не делает системный вызов
+struct SharedState {
+    long long sequence;
+    int generation;
+    int watchers;
+    int rows;
+    int columns;
+};
+
+// Гистограмма длительностей: в корзине k - длительности от 2^k до 2^(k+1) нс
+struct Histogram {
+    unsigned long long count;
+    unsigned long long sum_ns;
+    unsigned long long buckets[METRICS_BUCKETS];
+};
+
+// Метрики сервера в разделяемой памяти. Их пишут все процессы и потоки сервера атомарными
+// сложениями, читает gardenstat, не вмешиваясь в поток событий
+struct Metrics {
+    unsigned long long plots_visited;
+    unsigned long long plots_processed;
+    unsigned long long events_written;
+    unsigned long long events_dropped;     // сообщения, выброшенные из очередей наблюдателей
+    unsigned long long ring_occupancy;     // событий в кольце после последнего чтения
+    unsigned long long ring_high_water;
+    unsigned long long gardeners_connected;
+    unsigned long long observers_connected;
+    unsigned long long plots_total;        // участков, которые нужно обработать
+    unsigned long long snapshot_retries;   // участки поля, копию которых пришлось повторять
+    unsigned long long repaired_writes;    // записи клеток, доведенные за умершие процессы
+    struct Histogram zone_wait;            // ожидание зоны (клетки) садовником
+    struct Histogram plot_time;            // время внутри handleGardenPlot
+    struct Histogram recv_time;            // прием кадров от садовников
+    struct Histogram send_time;            // отправка ответов садовникам
+    unsigned long long gardener_plots[METRICS_GARDENERS];  // обработанные участки по номерам
+};
+
+// Ожидания в одной зоне поля: сколько раз садовник застал зону занятой и сколько ждал
+struct ZoneContention {
+    unsigned long long waits;
+    unsigned long long blocked_ns;
+};
+
+// Профиль конкуренции за зоны. За заголовком в той же разделяемой памяти лежат счетчики
+// по зонам поля (без учета полос таблицы блокировок) и номера садовников, занявших блокировки
+struct Contention {
+    unsigned long long waits_for[CONTENTION_GARDENERS][CONTENTION_GARDENERS];  // [ждал][занимал]
+};
+
+// Режим виртуального времени: число садовников и длительность прохода через клетку
+#define VIRTUAL_SLOTS 1024
+#define VIRTUAL_TRAVEL 1
+
+// Момент пробуждения садовника в виртуальном времени. Равные моменты упорядочиваются
+// по номеру постановки в очередь
+struct VirtualWakeup {
+    long long time;
+    long long order;
+    int slot;
+};
+
+// Зона в режиме виртуального времени: билетная блокировка, садовники входят в зону
+// в порядке взятия билетов
+struct VirtualZone {
+    int next_ticket;
+    int serving;
+};
+
+// Планировщик виртуального времени, общий для процессов садовников. Часы переводятся на
+// ближайший момент пробуждения из кучи, только когда ни один садовник не может продолжить
+// работу в текущий момент (runnable == 0)
+struct VirtualClock {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    long long now;
+    long long order;
+    int runnable;        // садовники, которые работают в текущий момент, и еще не подключившиеся
+    int registered;
+    int expected;        // сколько садовников ждать перед запуском часов
+    int heap_size;
+    struct VirtualWakeup heap[VIRTUAL_SLOTS];
+    int used[VIRTUAL_SLOTS];
+    int woken[VIRTUAL_SLOTS];
+    struct VirtualZone zones[];
+};
+
+// Описание отрезка строки или столбца для пакетной обработки.
+// Передается сразу после Task со статусом TASK_BATCH, начало отрезка - (plot_i, plot_j)
+struct Segment {
+    int count;
+    int step_i;
+    int step_j;
+};
+
+// Стратегии обхода поля (как в gardener.c)
+enum route_strategy { ROW_SNAKE, COLUMN_SNAKE, SPIRAL, STRIPE };
+
+// Запрос "продвинь меня": передается сразу после Task со статусом TASK_ADVANCE.
+// Маршрут садовника состоит из прямых отрезков, поиск начинается с участка offset отрезка line.
+// first_line - строка, с которой начинается обход полосами (STRIPE)
+struct Route {
+    int strategy;
+    int first_line;
+    int line;
+    int offset;
+};
+
+// Ответ на запрос "продвинь меня": участок, который садовник обработал, его место в маршруте
+// и количество пропущенных перед ним участков. line = -1, если маршрут закончен
+struct Position {
+    int line;
+    int offset;
+    int plot_i;
+    int plot_j;
+    int skipped;
+};
+
+// Прямой отрезок маршрута
+struct RouteLine {
+    int plot_i;
+    int plot_j;
+    int count;
+    int step_i;
+    int step_j;
+};
+
+// Очередь исходящих сообщений наблюдателя: кольцевой буфер целых сообщений
+// и снимок поля, который отправляется раньше очереди
+struct OutputQueue {
+    char *data;
+    int capacity;
+    int head;
+    int size;
+    int partial;          // сколько байт осталось отправить от сообщения в начале очереди
+    int needs_snapshot;   // очередь сброшена, наблюдателю нужен новый снимок
+    int snapshot_pending; // наблюдатель стоит в очереди на построение снимка
+    long long sequence;   // номер последнего изменения, вошедшего в отправленный снимок
+    long dropped;         // сколько сообщений отброшено из-за переполнения
+    unsigned char *snapshot;
+    long snapshot_size;
+    long snapshot_sent;
 };
 
 struct Observer {
     int socket;
-    int is_new;
+    int is_new;           // первый снимок еще не отправлен целиком
     int is_active;
+    unsigned int generation;  // растет при каждом занятии слота, отсекает старые события epoll
+    struct OutputQueue *queue;
+    char request[sizeof(struct MessageHeader) + sizeof(struct ResyncRequest)];
+    int request_received;
 };
 
+// Статусы задачи
+#define TASK_PLOT 0
+#define TASK_FINISH 1
+#define TASK_BATCH 2
+#define TASK_ADVANCE 3
+
 #define PLOTS 2
-#define MAXQUEUE 5
+// Очередь ожидающих соединений: десятки садовников подключаются одновременно, а при переполнении
+// очереди подключение клиента может зависнуть
+#define MAXQUEUE SOMAXCONN
+#define MAX_BATCH 1024
+#define CONNECTION_BUFFER 4096
+#define POOL_QUEUE 1024
+
+// Бит слова занятости клетки: клетку ждет другой садовник
+#define PLOT_WAITERS (1 << 30)
+#define PLOT_SPINS 16
+
+// Номер садовника хранится в клетке поля и в слове занятости рядом с битом PLOT_WAITERS
+#define MAX_GARDENER_ID (PLOT_WAITERS - 1)
+
+// Модели обслуживания садовников
+enum server_mode { FORK_MODE, EPOLL_MODE, POOL_MODE };
+
+// Синхронизация садовников: семафоры зон или атомарные слова занятости клеток
+enum sync_mode { SEMAPHORE_SYNC, CAS_SYNC };
+
+// Время работы садовников: настоящее (nanosleep) или виртуальное
+enum clock_mode { REAL_CLOCK, VIRTUAL_CLOCK };
+
+// Что делать с наблюдателем, очередь которого переполнена
+enum slow_policy { DROP_OLDEST_SLOW, DISCONNECT_SLOW, SNAPSHOT_SLOW };
+
+// Необязательные параметры запуска сервера
+struct ServerOptions {
+    enum server_mode mode;
+    int threads;
+    int observer_queue;
+    enum slow_policy slow_policy;
+    enum sync_mode sync;
+    enum clock_mode clock;
+    int gardeners;
+    unsigned int seed;
+    int zone_rows;
+    int zone_columns;
+    int lock_stripes;
+    int metrics_port;
+    const char *contention;
+    const char *journal;
+};
 
 const char *shared_object = "/posix-shared-object";
 const char *sem_shared_object = "/posix-sem-shared-object";
-const char *observers_shared_object = "/posix-observers-shared-object";
+const char *state_shared_object = "/posix-state-shared-object";
+const char *occupants_shared_object = "/posix-occupants-shared-object";
+const char *clock_shared_object = "/posix-clock-shared-object";
+const char *bitmaps_shared_object = "/posix-bitmaps-shared-object";
+const char *events_shared_object = "/posix-events-shared-object";
+const char *metrics_shared_object = "/posix-metrics-shared-object";
+const char *contention_shared_object = "/posix-contention-shared-object";
+const char *versions_shared_object = "/posix-versions-shared-object";
+
+// Поле выводится в консоль целиком после каждого изменения, только если оно не больше этого
+#define CONSOLE_MAP_LIMIT 400
 
 int createClientSocket(char *server_ip, int server_port) {
     int client_socket;
@@ -95,21 +433,204 @@ void sendHandleRequest(int client_socket, struct Task task) {
     }
 }
 
-int pipe_fd[2];
+struct EventRing *event_ring;
+struct Metrics *metrics;
 
-void writeEventToPipe(struct Event *event) {
-    if (write(pipe_fd[1], event, sizeof(*event)) < 0) {
-        perror("Can't write to pipe");
-        exit(-1);
+void countMetric(unsigned long long *counter, unsigned long long value) {
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+void recordDuration(struct Histogram *histogram, long long duration) {
+    int bucket = duration > 0 ? 63 - __builtin_clzll(duration) : 0;
+    countMetric(&histogram->count, 1);
+    countMetric(&histogram->sum_ns, duration > 0 ? duration : 0);
+    countMetric(histogram->buckets + (bucket < METRICS_BUCKETS ? bucket : METRICS_BUCKETS - 1), 1);
+}
+
+long futex(int *address, int operation, int value) {
+    return syscall(SYS_futex, address, operation, value, NULL, NULL, 0);
+}
+
+// Запись события в кольцо. Если кольцо заполнено, писатель ждет, пока writer освободит ячейку
+void writeEvent(struct Event *event) {
+    unsigned int position = __atomic_fetch_add(&event_ring->head, 1, __ATOMIC_RELAXED);
+    struct EventSlot *slot = event_ring->slots + position % EVENT_RING_SIZE;
+
+    unsigned int sequence;
+    while ((sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE)) != position) {
+        __atomic_add_fetch(&event_ring->writers_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_SEQ_CST) == sequence) {
+            futex((int *)&slot->sequence, FUTEX_WAIT, (int)sequence);
+        }
+        __atomic_sub_fetch(&event_ring->writers_sleeping, 1, __ATOMIC_SEQ_CST);
+    }
+
+    memcpy(&slot->event, event, sizeof(*event));
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_SEQ_CST);
+    countMetric(&metrics->events_written, 1);
+    if (__atomic_load_n(&event_ring->reader_sleeping, __ATOMIC_SEQ_CST)) {
+        futex((int *)&slot->sequence, FUTEX_WAKE, INT_MAX);
+    }
+}
+
+// CLOCK_MONOTONIC читается через vDSO без системного вызова. CLOCK_MONOTONIC_COARSE
+// дешевле, но обновляется раз в тик (несколько мс), этого мало для задержек отдельных событий
+long long monotonicNanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Чтение следующего события из кольца, поток writer спит на futex, пока кольцо пусто.
+// timeout_ns < 0 - ждать без ограничения, иначе через timeout_ns нс без событий возвращается -1
+int readEvent(struct Event *event, long long timeout_ns) {
+    unsigned int position = event_ring->tail;
+    struct EventSlot *slot = event_ring->slots + position % EVENT_RING_SIZE;
+    long long deadline = timeout_ns >= 0 ? monotonicNanoseconds() + timeout_ns : 0;
+
+    unsigned int sequence;
+    while ((sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE)) != position + 1) {
+        struct timespec remaining;
+        if (timeout_ns >= 0) {
+            long long left = deadline - monotonicNanoseconds();
+            if (left <= 0) {
+                return -1;
+            }
+            remaining.tv_sec = left / 1000000000LL;
+            remaining.tv_nsec = left % 1000000000LL;
+        }
+        __atomic_store_n(&event_ring->reader_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_SEQ_CST) == sequence) {
+            syscall(SYS_futex, (int *)&slot->sequence, FUTEX_WAIT, (int)sequence,
+                    timeout_ns >= 0 ? &remaining : NULL, NULL, 0);
+        }
+        __atomic_store_n(&event_ring->reader_sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+
+    memcpy(event, &slot->event, sizeof(*event));
+    __atomic_store_n(&slot->sequence, position + EVENT_RING_SIZE, __ATOMIC_SEQ_CST);
+    event_ring->tail = position + 1;
+
+    unsigned int occupancy = __atomic_load_n(&event_ring->head, __ATOMIC_RELAXED) - event_ring->tail;
+    __atomic_store_n(&metrics->ring_occupancy, occupancy, __ATOMIC_RELAXED);
+    if (occupancy > metrics->ring_high_water) {
+        __atomic_store_n(&metrics->ring_high_water, occupancy, __ATOMIC_RELAXED);
+    }
+    if (__atomic_load_n(&event_ring->writers_sleeping, __ATOMIC_SEQ_CST)) {
+        futex((int *)&slot->sequence, FUTEX_WAKE, INT_MAX);
     }
+    return 0;
 }
 
+long long server_started_at;
+
+// Время события хранится числом, в текст оно переводится только при выводе
 void setEventWithCurrentTime(struct Event *event) {
-    time_t timer;
-    struct tm *tm_info;
-    timer = time(NULL);
-    tm_info = localtime(&timer);
-    //strftime(event->timestamp, sizeof(event->timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
+    event->timestamp = monotonicNanoseconds() - server_started_at;
+    event->journal.type = JOURNAL_NONE;
+}
+
+void setEventJournal(struct Event *event, enum journal_type type, int gardener_id, int row,
+                     int column) {
+    event->journal.type = type;
+    event->journal.gardener_id = gardener_id;
+    event->journal.row = row;
+    event->journal.column = column;
+}
+
+int formatTimestamp(char *buffer, long long timestamp) {
+    return sprintf(buffer, "[%lld.%09lld] ", timestamp / 1000000000LL, timestamp % 1000000000LL);
+}
+
+// Журнал пишет только поток writer, в порядке чтения событий из кольца. Записи копируются
+// в буфер и сбрасываются одним write при заполнении буфера и не реже раза в секунду: если
+// новых событий нет, writer ждет кольцо не дольше срока сброса (writeInfoToConsole).
+// Остаток буфера при остановке сбрасывает главный поток, когда writer уже завершился
+int journal_fd = -1;
+char journal_buffer[JOURNAL_BUFFER];
+int journal_used = 0;
+long long journal_flushed_at = 0;
+
+void writeJournal(const void *data, size_t size) {
+    const char *from = data;
+    while (size > 0) {
+        ssize_t written = write(journal_fd, from, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Unable to write journal");
+            return;
+        }
+        from += written;
+        size -= written;
+    }
+}
+
+void flushJournal() {
+    writeJournal(journal_buffer, journal_used);
+    journal_used = 0;
+}
+
+void appendJournal(const struct Event *event) {
+    struct JournalRecord record;
+    struct JournalPlot plot;
+    if (event->type == DELTA) {
+        record.type = JOURNAL_CLAIM;
+        record.gardener_id = event->delta.value;
+        plot.row = event->delta.row;
+        plot.column = event->delta.column;
+    } else if (event->journal.type != JOURNAL_NONE) {
+        record.type = event->journal.type;
+        record.gardener_id = event->journal.gardener_id;
+        plot.row = event->journal.row;
+        plot.column = event->journal.column;
+    } else {
+        return;
+    }
+    record.timestamp = event->timestamp;
+    record.length = sizeof(plot);
+
+    if (journal_used + sizeof(record) + sizeof(plot) > JOURNAL_BUFFER) {
+        flushJournal();
+    }
+    memcpy(journal_buffer + journal_used, &record, sizeof(record));
+    memcpy(journal_buffer + journal_used + sizeof(record), &plot, sizeof(plot));
+    journal_used += sizeof(record) + sizeof(plot);
+
+    if (event->timestamp - journal_flushed_at > 1000000000LL) {
+        flushJournal();
+        journal_flushed_at = event->timestamp;
+    }
+}
+
+// Заголовок и начальное поле записываются до подключения садовников
+void openJournal(const char *path, const int *field, struct FieldSize field_size) {
+    if ((journal_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror("Unable to create journal");
+        exit(-1);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    struct JournalHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    header.version = JOURNAL_VERSION;
+    header.header_size = sizeof(header);
+    header.rows = field_size.rows;
+    header.columns = field_size.columns;
+    header.started_at = now.tv_sec * 1000000000LL + now.tv_nsec;
+    writeJournal(&header, sizeof(header));
+
+    long cells = (long)field_size.rows * field_size.columns;
+    for (long k = 0; k < cells; ++k) {
+        if (journal_used == JOURNAL_BUFFER) {
+            flushJournal();
+        }
+        journal_buffer[journal_used++] = field[k] >= 0;
+    }
+    flushJournal();
 }
 
 int createServerSocket(in_addr_t sin_addr, int port) {
@@ -121,6 +642,10 @@ int createServerSocket(in_addr_t sin_addr, int port) {
         exit(-1);
     }
 
+    // Повторный запуск сервера не должен ждать освобождения порта из TIME_WAIT
+    int reuse = 1;
+    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
     memset(&server_address, 0, sizeof(server_address));
     server_address.sin_family = AF_INET;
     server_address.sin_addr.s_addr = sin_addr;
@@ -139,7 +664,9 @@ int createServerSocket(in_addr_t sin_addr, int port) {
     return server_socket;
 }
 
-int acceptClientConnection(int server_socket) {
+// Сообщение о подключении имеет тип type: подключения садовников видят наблюдатели,
+// остальные подключения (S_CONSOLE) выводятся только в консоль
+int acceptClientConnection(int server_socket, enum event_type type) {
     int client_socket;
     struct sockaddr_in client_address;
     unsigned int address_length;
@@ -154,21 +681,41 @@ int acceptClientConnection(int server_socket) {
 
     struct Event event;
     setEventWithCurrentTime(&event);
-    event.type = S_INFO;
+    event.type = type;
     sprintf(event.buffer, "Connected client %s:%d\n", inet_ntoa(client_address.sin_addr),
             client_address.sin_port);
-    writeEventToPipe(&event);
+    if (type == S_INFO) {
+        setEventJournal(&event, JOURNAL_CONNECT, 0, (int)client_address.sin_addr.s_addr,
+                        ntohs(client_address.sin_port));
+    }
+    writeEvent(&event);
 
     return client_socket;
 }
 
+// Ширина столбца карты - число цифр в наибольшем номере садовника
+int fieldMaxValue(const int *field, long cells) {
+    int max_value = 0;
+    for (long k = 0; k < cells; ++k) {
+        if (field[k] > max_value) {
+            max_value = field[k];
+        }
+    }
+    return max_value;
+}
+
+int fieldCellWidth(const int *field, long cells) {
+    return snprintf(NULL, 0, "%d", fieldMaxValue(field, cells));
+}
+
 void printField(int *field, int columns, int rows) {
+    int width = fieldCellWidth(field, (long)rows * columns);
     for (int i = 0; i < rows; ++i) {
         for (int j = 0; j < columns; ++j) {
             if (field[i * columns + j] < 0) {
-                printf("X ");
+                printf("%*s ", width, "X");
             } else {
-                printf("%d ", field[i * columns + j]);
+                printf("%*d ", width, field[i * columns + j]);
             }
         }
         printf("\n");
@@ -177,183 +724,1204 @@ void printField(int *field, int columns, int rows) {
     fflush(stdout);
 }
 
-void sprintField(char *buffer, int *field, int columns, int rows) {
-    int offset = 0;
-    for (int i = 0; i < rows; ++i) {
-        for (int j = 0; j < columns; ++j) {
-            if (field[i * columns + j] < 0) {
-                offset += sprintf(buffer + offset, "X ");
-            } else {
-                offset += sprintf(buffer + offset, "%d ", field[i * columns + j]);
-            }
+// Форма зоны (по умолчанию PLOTS x PLOTS) и размер таблицы блокировок.
+// При lock_stripes > 0 зоны делят между собой не больше lock_stripes блокировок
+int zone_rows = PLOTS;
+int zone_columns = PLOTS;
+int lock_stripes = 0;
+
+// Количество блокировок: по одной на зону, покрывающую поле (крайние зоны могут быть
+// неполными), или размер таблицы, если он меньше
+int zoneCount(struct FieldSize field_size) {
+    long zones = (long)((field_size.rows + zone_rows - 1) / zone_rows) *
+                 ((field_size.columns + zone_columns - 1) / zone_columns);
+    return lock_stripes > 0 && lock_stripes < zones ? lock_stripes : zones;
+}
+
+// Номер зоны на поле без учета полос таблицы блокировок
+long fieldZone(struct FieldSize field_size, int plot_i, int plot_j) {
+    int zones_in_row = (field_size.columns + zone_columns - 1) / zone_columns;
+    return (long)(plot_i / zone_rows) * zones_in_row + plot_j / zone_columns;
+}
+
+int zoneIndex(struct FieldSize field_size, int plot_i, int plot_j) {
+    long zone = fieldZone(field_size, plot_i, plot_j);
+    return lock_stripes > 0 ? zone % lock_stripes : zone;
+}
+
+sem_t *zoneSemaphore(sem_t *semaphores, struct FieldSize field_size, int plot_i, int plot_j) {
+    return semaphores + zoneIndex(field_size, plot_i, plot_j);
+}
+
+// Версии участков поля (tile_versions.h) для согласованного чтения без семафоров зон
+struct TileVersion *tile_versions;
+
+// Незаконченная запись процесса садовника в режиме fork: номер участка + 1 или 0. Страница
+// общая с сервером: если процесс убит посреди записи, сервер доводит запись за него
+// (releaseChild). В потоках сервера отметка не нужна, она равна NULL
+int *open_tile_write = NULL;
+// SIGINT внутри записи откладывается до endTileWrite, чтобы процесс не вышел посреди нее
+volatile sig_atomic_t tile_writing = 0;
+volatile sig_atomic_t exit_requested = 0;
+
+struct TileVersion *beginTileWrite(long index) {
+    struct TileVersion *tile = tile_versions + index / TILE_CELLS;
+    if (open_tile_write != NULL) {
+        tile_writing = 1;
+    }
+    __atomic_fetch_add(&tile->begun, 1, __ATOMIC_SEQ_CST);
+    if (open_tile_write != NULL) {
+        __atomic_store_n(open_tile_write, (int)(index / TILE_CELLS) + 1, __ATOMIC_SEQ_CST);
+    }
+    return tile;
+}
+
+void endTileWrite(struct TileVersion *tile) {
+    if (open_tile_write != NULL) {
+        __atomic_store_n(open_tile_write, 0, __ATOMIC_SEQ_CST);
+    }
+    __atomic_fetch_add(&tile->ended, 1, __ATOMIC_SEQ_CST);
+    if (open_tile_write != NULL) {
+        tile_writing = 0;
+        if (exit_requested) {
+            raise(SIGINT);
         }
-        offset += sprintf(buffer + offset, "\n");
     }
 }
 
-void handleGardenPlot(sem_t *semaphores, int *field, int columns, struct Task task) {
-    sem_wait(semaphores + (task.plot_i / 2 * (columns / 2) + task.plot_j / 2));
+// Согласованная копия клеток [first, first + count) по участкам. Каждая клетка меняется не
+// больше одного раза, поэтому повторов копирования участка не больше, чем в нем клеток
+void copyCells(int *to, const int *field, long first, long count) {
+    long end = first + count;
+    while (first < end) {
+        long tile_end = (first / TILE_CELLS + 1) * TILE_CELLS;
+        long part = (tile_end < end ? tile_end : end) - first;
+        if (copyTile(to, field + first, tile_versions + first / TILE_CELLS, part)) {
+            countMetric(&metrics->snapshot_retries, 1);
+        }
+        to += part;
+        first += part;
+    }
+}
 
-    struct Event gardener_event;
-    setEventWithCurrentTime(&gardener_event);
-    gardener_event.type = ACTION;
-    sprintf(gardener_event.buffer, "Gardener %d at row: %d, col: %d\n", task.gardener_id,
-            task.plot_i, task.plot_j);
-    writeEventToPipe(&gardener_event);
+// Вывод карты поля в кольцо событий частями по размеру буфера события. Каждая строка
+// копируется по версиям участков. Семафор map_lock не дает частям разных карт перемешаться
+void writeFieldEvents(sem_t *map_lock, int *field, struct FieldSize field_size) {
+    struct Event event;
+    int offset = sprintf(event.buffer, "\n");
+    int *row = malloc(field_size.columns * sizeof(int));
+
+    sem_wait(map_lock);
+    for (int i = 0; i < field_size.rows; ++i) {
+        copyCells(row, field, (long)i * field_size.columns, field_size.columns);
+        for (int j = 0; j < field_size.columns; ++j) {
+            if (offset > (int)sizeof(event.buffer) - 16) {
+                setEventWithCurrentTime(&event);
+                event.type = MAP_CHUNK;
+                writeEvent(&event);
+                offset = 0;
+            }
 
-    if (field[task.plot_i * columns + task.plot_j] == 0) {
-        field[task.plot_i * columns + task.plot_j] = task.gardener_id;
-        usleep(task.working_time * 1000);
-    } else {
-        usleep(task.working_time / PLOTS * 1000);
+            int value = row[j];
+            if (value < 0) {
+                offset += sprintf(event.buffer + offset, "X ");
+            } else {
+                offset += sprintf(event.buffer + offset, "%d ", value);
+            }
+        }
+        offset += sprintf(event.buffer + offset, "\n");
     }
 
-    struct Event event;
     setEventWithCurrentTime(&event);
-    sprintf(event.buffer, "\n");
-    sprintField(event.buffer + 1, field, columns, columns);
     event.type = MAP;
-    writeEventToPipe(&event);
-
-    sem_post(semaphores + (task.plot_i / 2 * (columns / 2) + task.plot_j / 2));
+    writeEvent(&event);
+    sem_post(map_lock);
+    free(row);
 }
 
-void publishLostConnectionMessage(int gardener_id) {
-    struct Event finish_event;
-    setEventWithCurrentTime(&finish_event);
-    finish_event.type = S_INFO;
-    sprintf(finish_event.buffer, "Lost connection with gardener %d\n", gardener_id);
-    writeEventToPipe(&finish_event);
-}
+struct SharedState *shared_state;
 
-void introduceNewConnection(int gardener_id) {
+// Публикация изменения клетки. Вызывается под семафором зоны, поэтому номера изменений
+// одной клетки идут в том же порядке, что и сами изменения
+void publishDelta(int row, int column, int value) {
     struct Event event;
     setEventWithCurrentTime(&event);
-    event.type = S_INFO;
-    sprintf(event.buffer, "New connection from gardener %d\n", gardener_id);
-    writeEventToPipe(&event);
+    event.type = DELTA;
+    event.delta.sequence = __atomic_add_fetch(&shared_state->sequence, 1, __ATOMIC_SEQ_CST);
+    event.delta.row = row;
+    event.delta.column = column;
+    event.delta.value = value;
+    writeEvent(&event);
 }
 
-void handle(int client_socket, sem_t *semaphores, int *field, struct FieldSize field_size) {
-    char buffer[256];
-    int bytes_received;
-
-    if (send(client_socket, (char *)(&field_size), sizeof(field_size), 0) != sizeof(field_size)) {
-        perror("send() bad");
-        exit(-1);
+// Сообщение локальным наблюдателям об изменении поля
+void bumpFieldGeneration() {
+    __atomic_add_fetch(&shared_state->generation, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shared_state->watchers, __ATOMIC_SEQ_CST) > 0) {
+        futex(&shared_state->generation, FUTEX_WAKE, INT_MAX);
     }
+}
 
-    // Десериализация объекта
-    struct Task task;
-    const int plot_handle_status = 1;
-
-    if ((bytes_received = recv(client_socket, buffer, sizeof(struct Task), MSG_NOSIGNAL)) !=
-        sizeof(struct Task)) {
-        publishLostConnectionMessage(task.gardener_id);
-        close(client_socket);
-        exit(0);
+// Битовые карты необработанных клеток: для каждой строки row_words слов по 64 клетки,
+// затем для каждого столбца column_words слов. Бит снимается, когда клетку обрабатывают
+uint64_t *row_bitmaps;
+uint64_t *column_bitmaps;
+int row_words;
+int column_words;
+
+void setUnprocessedBits(int *field, struct FieldSize field_size) {
+    for (int i = 0; i < field_size.rows; ++i) {
+        for (int j = 0; j < field_size.columns; ++j) {
+            if (field[(long)i * field_size.columns + j] == 0) {
+                metrics->plots_total++;
+                row_bitmaps[(long)i * row_words + j / 64] |= 1ULL << (j % 64);
+                column_bitmaps[(long)j * column_words + i / 64] |= 1ULL << (i % 64);
+            }
+        }
     }
-    task = *((struct Task *)buffer);
+}
 
-    while (task.status != 1) {
-        handleGardenPlot(semaphores, field, field_size.columns, task);
+void clearUnprocessedBit(int plot_i, int plot_j) {
+    __atomic_fetch_and(row_bitmaps + (long)plot_i * row_words + plot_j / 64,
+                       ~(1ULL << (plot_j % 64)), __ATOMIC_RELAXED);
+    __atomic_fetch_and(column_bitmaps + (long)plot_j * column_words + plot_i / 64,
+                       ~(1ULL << (plot_i % 64)), __ATOMIC_RELAXED);
+}
 
-        int sent;
-        if ((sent = send(client_socket, &plot_handle_status, sizeof(int), MSG_NOSIGNAL)) !=
-            sizeof(int)) {
-            publishLostConnectionMessage(task.gardener_id);
-            close(client_socket);
-            exit(0);
+// Поиск первого установленного бита между from и to включительно в направлении от from к to
+// по слову за раз. Возвращает номер бита или -1
+int findUnprocessedBit(uint64_t *bitmap, int from, int to) {
+    if (from <= to) {
+        for (int word = from / 64; word <= to / 64; ++word) {
+            uint64_t bits = __atomic_load_n(bitmap + word, __ATOMIC_RELAXED);
+            if (word == from / 64) {
+                bits &= ~0ULL << (from % 64);
+            }
+            if (bits != 0) {
+                int found = word * 64 + __builtin_ctzll(bits);
+                return found <= to ? found : -1;
+            }
         }
-
-        if ((bytes_received = recv(client_socket, buffer, sizeof(struct Task),
-                                   MSG_NOSIGNAL)) != sizeof(struct Task)) {
-            publishLostConnectionMessage(task.gardener_id);
-            close(client_socket);
-            exit(0);
+    } else {
+        for (int word = from / 64; word >= to / 64; --word) {
+            uint64_t bits = __atomic_load_n(bitmap + word, __ATOMIC_RELAXED);
+            if (word == from / 64 && from % 64 != 63) {
+                bits &= (1ULL << (from % 64 + 1)) - 1;
+            }
+            if (bits != 0) {
+                int found = word * 64 + 63 - __builtin_clzll(bits);
+                return found >= to ? found : -1;
+            }
         }
-        task = *((struct Task *)buffer);
     }
+    return -1;
+}
 
-    struct Event finish_event;
-    setEventWithCurrentTime(&finish_event);
-    finish_event.type = ACTION;
-    sprintf(finish_event.buffer, "Gardener %d finished his work\n", task.gardener_id);
-    writeEventToPipe(&finish_event);
+enum sync_mode sync_mode = SEMAPHORE_SYNC;
+int *occupants;
+
+// Вход садовника в клетку в режиме CAS: слово клетки атомарно меняется с 0 на номер садовника.
+// Если клетка занята, садовник немного крутится, а затем засыпает на futex, отметив в слове
+// клетки, что его ждут
+void enterPlot(int *occupant, int gardener_id) {
+    int waited = 0;
+    for (int spins = 0;; ++spins) {
+        int current = 0;
+        int owner = waited ? gardener_id | PLOT_WAITERS : gardener_id;
+        if (__atomic_compare_exchange_n(occupant, &current, owner, 0, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+            return;
+        }
+        if (spins < PLOT_SPINS) {
+            sched_yield();
+            continue;
+        }
+        if (!(current & PLOT_WAITERS) &&
+            !__atomic_compare_exchange_n(occupant, &current, current | PLOT_WAITERS, 0,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        futex(occupant, FUTEX_WAIT, current | PLOT_WAITERS);
+        waited = 1;
+    }
+}
 
-    int sent;
-    if ((sent = send(client_socket, &plot_handle_status, sizeof(int), MSG_NOSIGNAL)) !=
-        sizeof(int)) {
-        publishLostConnectionMessage(task.gardener_id);
-        close(client_socket);
-        exit(0);
+// Выход из клетки: системный вызов нужен, только если клетку кто-то ждет
+void leavePlot(int *occupant) {
+    if (__atomic_exchange_n(occupant, 0, __ATOMIC_RELEASE) & PLOT_WAITERS) {
+        futex(occupant, FUTEX_WAKE, INT_MAX);
     }
+}
 
-    close(client_socket);
+struct VirtualClock *virtual_clock;
+int virtual_slot = -1;
+
+int earlierWakeup(struct VirtualWakeup *a, struct VirtualWakeup *b) {
+    return a->time < b->time || (a->time == b->time && a->order < b->order);
 }
 
-int *getField(int field_size) {
-    int *field;
-    int shmid;
+void pushWakeup(struct VirtualClock *clock, struct VirtualWakeup wakeup) {
+    int i = clock->heap_size++;
+    while (i > 0 && earlierWakeup(&wakeup, clock->heap + (i - 1) / 2)) {
+        clock->heap[i] = clock->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    clock->heap[i] = wakeup;
+}
 
-    if ((shmid = shm_open(shared_object, O_CREAT | O_RDWR, 0666)) < 0) {
-        perror("Can't connect to shared memory");
-        exit(-1);
-    } else {
-        if (ftruncate(shmid, field_size * sizeof(int)) < 0) {
-            perror("Can't resize shared memory");
-            exit(-1);
+struct VirtualWakeup popWakeup(struct VirtualClock *clock) {
+    struct VirtualWakeup top = clock->heap[0];
+    struct VirtualWakeup last = clock->heap[--clock->heap_size];
+    int i = 0;
+    while (2 * i + 1 < clock->heap_size) {
+        int child = 2 * i + 1;
+        if (child + 1 < clock->heap_size &&
+            earlierWakeup(clock->heap + child + 1, clock->heap + child)) {
+            ++child;
         }
-        if ((field = mmap(0, field_size * sizeof(int), PROT_WRITE | PROT_READ, MAP_SHARED, shmid,
-                          0)) < 0) {
-            printf("Can't connect to shared memory\n");
-            exit(-1);
-        };
+        if (!earlierWakeup(clock->heap + child, &last)) {
+            break;
+        }
+        clock->heap[i] = clock->heap[child];
+        i = child;
     }
-
-    return field;
+    clock->heap[i] = last;
+    return top;
 }
 
-struct Observer *getObserversMemory() {
-    struct Observer *observers;
-    int shmid;
+// Если все садовники ждут, часы переводятся на ближайший момент пробуждения и будится
+// один садовник. Вызывается под mutex планировщика
+void advanceVirtualClock(struct VirtualClock *clock) {
+    if (clock->runnable > 0 || clock->heap_size == 0) {
+        return;
+    }
+    struct VirtualWakeup wakeup = popWakeup(clock);
+    clock->now = wakeup.time;
+    clock->woken[wakeup.slot] = 1;
+    clock->runnable++;
+    pthread_cond_broadcast(&clock->changed);
+}
 
-    if ((shmid = shm_open(observers_shared_object, O_CREAT | O_RDWR, 0666)) < 0) {
-        perror("Can't connect to shared memory");
-        exit(-1);
-    } else {
-        if (ftruncate(shmid, 100 * sizeof(struct Observer)) < 0) {
-            perror("Can't resize shared memory");
-            exit(-1);
+// Регистрация садовника в планировщике, возвращает его слот или -1, если слотов нет.
+// Первые expected садовников уже учтены в runnable, поэтому часы не идут, пока они все
+// не подключатся
+int registerVirtualGardener(struct VirtualClock *clock) {
+    pthread_mutex_lock(&clock->mutex);
+    int slot = -1;
+    for (int i = 0; i < VIRTUAL_SLOTS && slot < 0; ++i) {
+        if (!clock->used[i]) {
+            slot = i;
+        }
+    }
+    if (slot >= 0) {
+        clock->used[slot] = 1;
+        if (++clock->registered > clock->expected) {
+            clock->runnable++;
         }
-        if ((observers = mmap(0, 100 * sizeof(struct Observer), PROT_WRITE | PROT_READ, MAP_SHARED,
-                              shmid, 0)) < 0) {
-            printf("Can't connect to shared memory\n");
-            exit(-1);
-        };
     }
+    pthread_mutex_unlock(&clock->mutex);
+    return slot;
+}
 
-    return observers;
+void unregisterVirtualGardener(struct VirtualClock *clock, int slot) {
+    pthread_mutex_lock(&clock->mutex);
+    clock->used[slot] = 0;
+    clock->runnable--;
+    advanceVirtualClock(clock);
+    pthread_mutex_unlock(&clock->mutex);
 }
 
-void initializeField(int *field, int rows, int columns) {
-    for (int i = 0; i < rows; ++i) {
-        for (int j = 0; j < columns; ++j) {
-            field[i * columns + j] = 0;
-        }
+// Настоящее ожидание садовника в миллисекундах. usleep не обязан принимать больше секунды,
+// а время прохода многих участков не помещается в int микросекунд, поэтому nanosleep;
+// прерванное сигналом ожидание продолжается на оставшееся время
+void sleepMilliseconds(long long duration) {
+    if (duration <= 0) {
+        return;
     }
+    struct timespec left;
+    left.tv_sec = duration / 1000;
+    left.tv_nsec = duration % 1000 * 1000000;
+    while (nanosleep(&left, &left) < 0 && errno == EINTR) {
+    }
+}
 
-    int percentage = 10 + random() % 20;
-    int count_of_bad_plots = columns * rows * percentage / 100;
-    for (int i = 0; i < count_of_bad_plots; ++i) {
-        int row_index;
-        int column_index;
-        do {
-            row_index = random() % rows;
-            column_index = random() % columns;
-        } while (field[row_index * columns + column_index] == -1);
-
-        field[row_index * columns + column_index] = -1;
+// Вместо usleep садовник ставит момент своего пробуждения в кучу и ждет, пока часы до него дойдут
+void virtualSleep(struct VirtualClock *clock, int slot, long long duration) {
+    pthread_mutex_lock(&clock->mutex);
+    struct VirtualWakeup wakeup = { clock->now + duration, clock->order++, slot };
+    pushWakeup(clock, wakeup);
+    clock->woken[slot] = 0;
+    clock->runnable--;
+    advanceVirtualClock(clock);
+    while (!clock->woken[slot]) {
+        pthread_cond_wait(&clock->changed, &clock->mutex);
+    }
+    pthread_mutex_unlock(&clock->mutex);
+}
+
+// Садовник, ожидающий зону, не может работать, пока ее не освободят, поэтому ожидание
+// учитывается планировщиком. Освобождающий садовник сам учитывает следующего как работающего
+void enterVirtualZone(struct VirtualClock *clock, int zone) {
+    pthread_mutex_lock(&clock->mutex);
+    int ticket = clock->zones[zone].next_ticket++;
+    if (ticket != clock->zones[zone].serving) {
+        clock->runnable--;
+        advanceVirtualClock(clock);
+        while (clock->zones[zone].serving != ticket) {
+            pthread_cond_wait(&clock->changed, &clock->mutex);
+        }
+    }
+    pthread_mutex_unlock(&clock->mutex);
+}
+
+void leaveVirtualZone(struct VirtualClock *clock, int zone) {
+    pthread_mutex_lock(&clock->mutex);
+    if (++clock->zones[zone].serving != clock->zones[zone].next_ticket) {
+        clock->runnable++;
+        pthread_cond_broadcast(&clock->changed);
+    }
+    pthread_mutex_unlock(&clock->mutex);
+}
+
+// Профиль конкуренции (--contention), NULL если выключен
+struct Contention *contention;
+struct ZoneContention *zone_contention;
+int *zone_holders;
+
+// Кто занимает блокировку участка. В режиме CAS номер хранится в слове занятости клетки,
+// в остальных режимах - в zone_holders. Значение читается без блокировки и нужно только
+// для статистики
+int lockHolder(struct FieldSize field_size, struct Task task) {
+    if (sync_mode == CAS_SYNC && virtual_clock == NULL) {
+        long index = (long)task.plot_i * field_size.columns + task.plot_j;
+        return __atomic_load_n(occupants + index, __ATOMIC_RELAXED) & MAX_GARDENER_ID;
+    }
+    return __atomic_load_n(zone_holders + zoneIndex(field_size, task.plot_i, task.plot_j),
+                           __ATOMIC_RELAXED);
+}
+
+void setLockHolder(struct FieldSize field_size, struct Task task, int gardener_id) {
+    if (sync_mode != CAS_SYNC || virtual_clock != NULL) {
+        __atomic_store_n(zone_holders + zoneIndex(field_size, task.plot_i, task.plot_j),
+                         gardener_id, __ATOMIC_RELAXED);
+    }
+}
+
+void recordContention(struct FieldSize field_size, struct Task task, int holder, long long waited) {
+    struct ZoneContention *zone = zone_contention + fieldZone(field_size, task.plot_i, task.plot_j);
+    int waiter = task.gardener_id < CONTENTION_GARDENERS ? task.gardener_id
+                                                         : CONTENTION_GARDENERS - 1;
+    holder = holder < CONTENTION_GARDENERS ? holder : CONTENTION_GARDENERS - 1;
+    countMetric(&zone->waits, 1);
+    countMetric(&zone->blocked_ns, waited);
+    countMetric(&contention->waits_for[waiter][holder], 1);
+}
+
+void handleGardenPlot(sem_t *semaphores, int *field, struct FieldSize field_size,
+                      struct Task task) {
+    long long started_at = monotonicNanoseconds();
+    long index = (long)task.plot_i * field_size.columns + task.plot_j;
+    int holder = contention != NULL ? lockHolder(field_size, task) : 0;
+    sem_t *zone = NULL;
+    if (virtual_clock != NULL) {
+        enterVirtualZone(virtual_clock, zoneIndex(field_size, task.plot_i, task.plot_j));
+    } else if (sync_mode == CAS_SYNC) {
+        enterPlot(occupants + index, task.gardener_id);
+    } else {
+        zone = zoneSemaphore(semaphores, field_size, task.plot_i, task.plot_j);
+        sem_wait(zone);
+    }
+    long long waited = monotonicNanoseconds() - started_at;
+    recordDuration(&metrics->zone_wait, waited);
+    countMetric(&metrics->plots_visited, 1);
+    if (contention != NULL) {
+        setLockHolder(field_size, task, task.gardener_id);
+        if (holder != 0 && holder != task.gardener_id) {
+            recordContention(field_size, task, holder, waited);
+        }
+    }
+
+    struct Event gardener_event;
+    setEventWithCurrentTime(&gardener_event);
+    gardener_event.type = ACTION;
+    sprintf(gardener_event.buffer, "Gardener %d at row: %d, col: %d\n", task.gardener_id,
+            task.plot_i, task.plot_j);
+    setEventJournal(&gardener_event, JOURNAL_MOVE, task.gardener_id, task.plot_i, task.plot_j);
+    writeEvent(&gardener_event);
+
+    // Клетку держит только этот садовник, поэтому обработанную клетку можно проверить без
+    // версии участка: читающие копию не повторяют ее из-за проходов по обработанным клеткам
+    int claimed = 0;
+    if (__atomic_load_n(field + index, __ATOMIC_RELAXED) == 0) {
+        int unprocessed = 0;
+        struct TileVersion *tile = beginTileWrite(index);
+        claimed = __atomic_compare_exchange_n(field + index, &unprocessed, task.gardener_id, 0,
+                                              __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+        endTileWrite(tile);
+    }
+    if (claimed) {
+        clearUnprocessedBit(task.plot_i, task.plot_j);
+        countMetric(&metrics->plots_processed, 1);
+        if (task.gardener_id < METRICS_GARDENERS) {
+            countMetric(metrics->gardener_plots + task.gardener_id, 1);
+        }
+        publishDelta(task.plot_i, task.plot_j, task.gardener_id);
+        bumpFieldGeneration();
+        if (virtual_clock != NULL) {
+            virtualSleep(virtual_clock, virtual_slot, task.working_time);
+        } else {
+            sleepMilliseconds(task.working_time);
+        }
+    } else if (virtual_clock != NULL) {
+        virtualSleep(virtual_clock, virtual_slot, VIRTUAL_TRAVEL);
+    } else {
+        sleepMilliseconds(task.working_time / PLOTS);
+    }
+
+    if (contention != NULL) {
+        setLockHolder(field_size, task, 0);
+    }
+    if (virtual_clock != NULL) {
+        leaveVirtualZone(virtual_clock, zoneIndex(field_size, task.plot_i, task.plot_j));
+    } else if (sync_mode == CAS_SYNC) {
+        leavePlot(occupants + index);
+    } else {
+        sem_post(zone);
+    }
+    recordDuration(&metrics->plot_time, monotonicNanoseconds() - started_at);
+}
+
+void publishLostConnectionMessage(int gardener_id) {
+    struct Event finish_event;
+    setEventWithCurrentTime(&finish_event);
+    finish_event.type = S_INFO;
+    sprintf(finish_event.buffer, "Lost connection with gardener %d\n", gardener_id);
+    setEventJournal(&finish_event, JOURNAL_FINISH, gardener_id, 1, 0);
+    writeEvent(&finish_event);
+}
+
+// Сообщение о времени от принятия соединения до первого подтверждения садовнику
+void publishFirstAckLatency(int gardener_id, struct timespec accepted_at) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long latency_us =
+        (now.tv_sec - accepted_at.tv_sec) * 1000000L + (now.tv_nsec - accepted_at.tv_nsec) / 1000;
+
+    struct Event event;
+    setEventWithCurrentTime(&event);
+    event.type = S_INFO;
+    sprintf(event.buffer, "First ack to gardener %d after %ld us\n", gardener_id, latency_us);
+    writeEvent(&event);
+}
+
+void introduceNewConnection(int gardener_id) {
+    struct Event event;
+    setEventWithCurrentTime(&event);
+    event.type = S_INFO;
+    sprintf(event.buffer, "New connection from gardener %d\n", gardener_id);
+    writeEvent(&event);
+}
+
+// Чтение ровно size байт из потокового сокета
+int recvAll(int socket, void *buffer, int size) {
+    long long started_at = monotonicNanoseconds();
+    int received = 0;
+    while (received < size) {
+        int bytes = recv(socket, (char *)buffer + received, size - received, MSG_NOSIGNAL);
+        if (bytes <= 0) {
+            return bytes;
+        }
+        received += bytes;
+    }
+    recordDuration(&metrics->recv_time, monotonicNanoseconds() - started_at);
+    return received;
+}
+
+// Отправка ровно size байт; неблокирующий сокет дожидается готовности к записи
+int sendAll(int socket, const void *buffer, int size) {
+    long long started_at = monotonicNanoseconds();
+    int sent = 0;
+    while (sent < size) {
+        int bytes = send(socket, (const char *)buffer + sent, size - sent, MSG_NOSIGNAL);
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pending = { .fd = socket, .events = POLLOUT };
+            poll(&pending, 1, -1);
+            continue;
+        }
+        if (bytes <= 0) {
+            return -1;
+        }
+        sent += bytes;
+    }
+    recordDuration(&metrics->send_time, monotonicNanoseconds() - started_at);
+    return sent;
+}
+
+// Отрезок строки или столбца: ровно один шаг равен +-1, другой 0
+int isAxisStep(int step_i, int step_j) {
+    return (step_i == 0 && (step_j == 1 || step_j == -1)) ||
+           (step_j == 0 && (step_i == 1 || step_i == -1));
+}
+
+// Обработка отрезка участков одним кадром: в ответ отправляется количество
+// участков и для каждого из них значение поля после посещения. Длина, шаг и первый участок
+// проверяются до вычисления последнего участка, поэтому оно не переполняется
+int handleGardenSegment(int client_socket, sem_t *semaphores, int *field,
+                        struct FieldSize field_size, struct Task task, struct Segment segment) {
+    if (segment.count < 1 || segment.count > MAX_BATCH ||
+        !isAxisStep(segment.step_i, segment.step_j) || task.plot_i < 0 || task.plot_j < 0 ||
+        task.plot_i >= field_size.rows || task.plot_j >= field_size.columns) {
+        return -1;
+    }
+    int last_i = task.plot_i + (segment.count - 1) * segment.step_i;
+    int last_j = task.plot_j + (segment.count - 1) * segment.step_j;
+    if (last_i < 0 || last_j < 0 || last_i >= field_size.rows || last_j >= field_size.columns) {
+        return -1;
+    }
+
+    int results[MAX_BATCH + 1];
+    results[0] = segment.count;
+    for (int k = 0; k < segment.count; ++k) {
+        handleGardenPlot(semaphores, field, field_size, task);
+        results[k + 1] = field[task.plot_i * field_size.columns + task.plot_j];
+        task.plot_i += segment.step_i;
+        task.plot_j += segment.step_j;
+    }
+
+    int size = (segment.count + 1) * sizeof(int);
+    if (sendAll(client_socket, results, size) != size) {
+        return -1;
+    }
+    return 0;
+}
+
+// Отрезок index маршрута садовника, тот же порядок, что и в buildRoute из gardener.c.
+// Отрезки спирали могут быть пустыми. Возвращает 0, если маршрут закончился
+int routeLine(struct Route route, struct FieldSize field_size, int index, struct RouteLine *line) {
+    int rows = field_size.rows;
+    int columns = field_size.columns;
+    line->count = 0;
+
+    if (route.strategy == ROW_SNAKE || route.strategy == STRIPE) {
+        if (index >= rows) {
+            return 0;
+        }
+        line->plot_i = route.strategy == STRIPE ? (route.first_line + index) % rows : index;
+        line->plot_j = index % 2 == 0 ? 0 : columns - 1;
+        line->count = columns;
+        line->step_i = 0;
+        line->step_j = index % 2 == 0 ? 1 : -1;
+    } else if (route.strategy == COLUMN_SNAKE) {
+        if (index >= columns) {
+            return 0;
+        }
+        line->plot_i = index % 2 == 0 ? rows - 1 : 0;
+        line->plot_j = columns - 1 - index;
+        line->count = rows;
+        line->step_i = index % 2 == 0 ? -1 : 1;
+        line->step_j = 0;
+    } else {
+        int layer = index / 4;
+        int top = layer, bottom = rows - 1 - layer, left = layer, right = columns - 1 - layer;
+        if (top > bottom || left > right) {
+            return 0;
+        }
+        int edge = index % 4;
+        line->step_i = edge == 1 ? 1 : edge == 3 ? -1 : 0;
+        line->step_j = edge == 0 ? 1 : edge == 2 ? -1 : 0;
+        if (edge == 0) {
+            line->plot_i = top;
+            line->plot_j = left;
+            line->count = right - left + 1;
+        } else if (edge == 1) {
+            line->plot_i = top + 1;
+            line->plot_j = right;
+            line->count = bottom - top;
+        } else if (edge == 2 && top < bottom) {
+            line->plot_i = bottom;
+            line->plot_j = right - 1;
+            line->count = right - left;
+        } else if (edge == 3 && left < right) {
+            line->plot_i = bottom - 1;
+            line->plot_j = left;
+            line->count = bottom - top - 1;
+        }
+    }
+    return 1;
+}
+
+// Садовник проходит пропущенные участки без остановки: время прохода начисляется
+// одним ожиданием и без блокировки зон
+void travelPast(struct Task task, int skipped) {
+    if (skipped == 0) {
+        return;
+    }
+    if (virtual_clock != NULL) {
+        virtualSleep(virtual_clock, virtual_slot, (long long)VIRTUAL_TRAVEL * skipped);
+    } else {
+        sleepMilliseconds((long long)(task.working_time / PLOTS) * skipped);
+    }
+}
+
+// Обработка запроса "продвинь меня": сервер сам идет по маршруту садовника, пропуская
+// необрабатываемые и уже обработанные участки, и обрабатывает первый свободный участок.
+// Садовнику не нужно отправлять задачу на каждый пропущенный участок
+int handleGardenAdvance(int client_socket, sem_t *semaphores, int *field,
+                        struct FieldSize field_size, struct Task task, struct Route route) {
+    if (route.strategy < ROW_SNAKE || route.strategy > STRIPE || route.first_line < 0 ||
+        route.first_line >= field_size.rows || route.line < 0 || route.offset < 0) {
+        return -1;
+    }
+
+    // Свободный участок отрезка ищется по битовой карте его строки или столбца
+    struct Position position = { -1, 0, -1, -1, 0 };
+    struct RouteLine line;
+    int offset = route.offset;
+    for (int l = route.line; position.line < 0 && routeLine(route, field_size, l, &line); ++l) {
+        if (offset < line.count) {
+            int found;
+            if (line.step_j != 0) {
+                int from = line.plot_j + offset * line.step_j;
+                int to = line.plot_j + (line.count - 1) * line.step_j;
+                found = findUnprocessedBit(row_bitmaps + (long)line.plot_i * row_words, from, to);
+                found = found < 0 ? -1 : (found - line.plot_j) * line.step_j;
+            } else {
+                int from = line.plot_i + offset * line.step_i;
+                int to = line.plot_i + (line.count - 1) * line.step_i;
+                found = findUnprocessedBit(column_bitmaps + (long)line.plot_j * column_words,
+                                           from, to);
+                found = found < 0 ? -1 : (found - line.plot_i) * line.step_i;
+            }
+
+            if (found < 0) {
+                position.skipped += line.count - offset;
+            } else {
+                position.skipped += found - offset;
+                position.line = l;
+                position.offset = found;
+                position.plot_i = line.plot_i + found * line.step_i;
+                position.plot_j = line.plot_j + found * line.step_j;
+            }
+        }
+        offset = 0;
+    }
+
+    travelPast(task, position.skipped);
+    if (position.line >= 0) {
+        // Пока садовник шел, участок мог занять другой садовник: тогда это обычный проход
+        task.plot_i = position.plot_i;
+        task.plot_j = position.plot_j;
+        handleGardenPlot(semaphores, field, field_size, task);
+    }
+
+    if (sendAll(client_socket, &position, sizeof(position)) != sizeof(position)) {
+        return -1;
+    }
+    return 0;
+}
+
+// Обработка одного кадра от садовника. Возвращает 0, если садовник продолжает работу,
+// 1 - если он закончил, и -1 при потере соединения
+int serveFrame(int client_socket, sem_t *semaphores, int *field, struct FieldSize field_size,
+               struct Task task, struct Segment segment, struct Route route) {
+    const int plot_handle_status = 1;
+
+    if (task.gardener_id < 1 || task.gardener_id > MAX_GARDENER_ID) {
+        return -1;
+    }
+    if (task.status == TASK_BATCH) {
+        return handleGardenSegment(client_socket, semaphores, field, field_size, task, segment);
+    }
+    if (task.status == TASK_ADVANCE) {
+        return handleGardenAdvance(client_socket, semaphores, field, field_size, task, route);
+    }
+
+    if (task.status == TASK_FINISH) {
+        struct Event finish_event;
+        setEventWithCurrentTime(&finish_event);
+        finish_event.type = ACTION;
+        // В виртуальном времени момент окончания выводится и в консоль сервера
+        if (virtual_clock != NULL) {
+            finish_event.type = S_INFO;
+            sprintf(finish_event.buffer, "Gardener %d finished his work at virtual time %lld\n",
+                    task.gardener_id, __atomic_load_n(&virtual_clock->now, __ATOMIC_RELAXED));
+        } else {
+            sprintf(finish_event.buffer, "Gardener %d finished his work\n", task.gardener_id);
+        }
+        setEventJournal(&finish_event, JOURNAL_FINISH, task.gardener_id, 0, 0);
+        writeEvent(&finish_event);
+    } else if (task.plot_i < 0 || task.plot_j < 0 || task.plot_i >= field_size.rows ||
+               task.plot_j >= field_size.columns) {
+        return -1;
+    } else {
+        handleGardenPlot(semaphores, field, field_size, task);
+    }
+
+    if (sendAll(client_socket, &plot_handle_status, sizeof(int)) != sizeof(int)) {
+        return -1;
+    }
+    return task.status == TASK_FINISH ? 1 : 0;
+}
+
+// Настройка только что принятого соединения садовника: отправка размера поля
+int greetGardener(int client_socket, struct FieldSize field_size) {
+    // Подтверждения отправляются потоком, не дожидаясь ACK от клиента
+    int no_delay = 1;
+    setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+    if (sendAll(client_socket, &field_size, sizeof(field_size)) != sizeof(field_size)) {
+        return -1;
+    }
+    return 0;
+}
+
+void handle(int client_socket, sem_t *semaphores, int *field, struct FieldSize field_size,
+            struct timespec accepted_at) {
+    if (greetGardener(client_socket, field_size) < 0) {
+        perror("send() bad");
+        close(client_socket);
+        return;
+    }
+    if (virtual_clock != NULL &&
+        (virtual_slot = registerVirtualGardener(virtual_clock)) < 0) {
+        fprintf(stderr, "Too many gardeners for virtual clock\n");
+        close(client_socket);
+        return;
+    }
+    countMetric(&metrics->gardeners_connected, 1);
+
+    // Десериализация объекта
+    struct Task task;
+    task.gardener_id = 0;
+    int status = 0;
+    int acknowledged = 0;
+
+    while (status == 0) {
+        struct Segment segment = { 0 };
+        struct Route route = { 0 };
+        if (recvAll(client_socket, &task, sizeof(struct Task)) != sizeof(struct Task) ||
+            (task.status == TASK_BATCH &&
+             recvAll(client_socket, &segment, sizeof(segment)) != sizeof(segment)) ||
+            (task.status == TASK_ADVANCE &&
+             recvAll(client_socket, &route, sizeof(route)) != sizeof(route))) {
+            status = -1;
+            break;
+        }
+        status = serveFrame(client_socket, semaphores, field, field_size, task, segment, route);
+        if (status >= 0 && !acknowledged) {
+            publishFirstAckLatency(task.gardener_id, accepted_at);
+            acknowledged = 1;
+        }
+    }
+
+    if (status < 0) {
+        publishLostConnectionMessage(task.gardener_id);
+    }
+    if (virtual_clock != NULL) {
+        unregisterVirtualGardener(virtual_clock, virtual_slot);
+    }
+    countMetric(&metrics->gardeners_connected, -1);
+    close(client_socket);
+}
+
+// Состояние соединения садовника в режиме epoll: буфер принятых, но еще не обработанных кадров
+struct Connection {
+    int socket;
+    int gardener_id;
+    int acknowledged;
+    struct timespec accepted_at;
+    int received;
+    char buffer[CONNECTION_BUFFER];
+};
+
+struct EpollServer {
+    int epoll_fd;
+    sem_t *semaphores;
+    int *field;
+    struct FieldSize field_size;
+};
+
+// Обработка всех целых кадров из буфера соединения (тот же протокол, что и в handle())
+int processConnectionFrames(struct EpollServer *server, struct Connection *connection) {
+    int offset = 0;
+    int status = 0;
+
+    while (status == 0 && connection->received - offset >= (int)sizeof(struct Task)) {
+        struct Task task;
+        struct Segment segment = { 0 };
+        struct Route route = { 0 };
+        int frame_size = sizeof(struct Task);
+        memcpy(&task, connection->buffer + offset, sizeof(task));
+        if (task.status == TASK_BATCH) {
+            frame_size += sizeof(struct Segment);
+            if (connection->received - offset < frame_size) {
+                break;
+            }
+            memcpy(&segment, connection->buffer + offset + sizeof(task), sizeof(segment));
+        } else if (task.status == TASK_ADVANCE) {
+            frame_size += sizeof(struct Route);
+            if (connection->received - offset < frame_size) {
+                break;
+            }
+            memcpy(&route, connection->buffer + offset + sizeof(task), sizeof(route));
+        }
+
+        connection->gardener_id = task.gardener_id;
+        status = serveFrame(connection->socket, server->semaphores, server->field,
+                            server->field_size, task, segment, route);
+        offset += frame_size;
+        if (status >= 0 && !connection->acknowledged) {
+            publishFirstAckLatency(task.gardener_id, connection->accepted_at);
+            connection->acknowledged = 1;
+        }
+    }
+
+    connection->received -= offset;
+    memmove(connection->buffer, connection->buffer + offset, connection->received);
+    return status;
+}
+
+// Чтение всех доступных данных соединения. Возвращает 0, если соединение нужно оставить
+int readConnection(struct EpollServer *server, struct Connection *connection) {
+    while (1) {
+        int bytes = recv(connection->socket, connection->buffer + connection->received,
+                         CONNECTION_BUFFER - connection->received, 0);
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            return -1;
+        }
+
+        connection->received += bytes;
+        int status = processConnectionFrames(server, connection);
+        if (status != 0) {
+            return status;
+        }
+    }
+}
+
+void *runEpollWorker(void *args) {
+    struct EpollServer *server = (struct EpollServer *)args;
+    while (1) {
+        // По одному событию за раз, чтобы долгая обработка участка не задерживала
+        // соединения, которые могли бы взять другие потоки
+        struct epoll_event event;
+        int count = epoll_wait(server->epoll_fd, &event, 1, -1);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            perror("epoll_wait failed");
+            exit(-1);
+        }
+
+        struct Connection *connection = (struct Connection *)event.data.ptr;
+        int status = readConnection(server, connection);
+        if (status == 0) {
+            // EPOLLONESHOT: соединение обслуживается не более чем одним потоком одновременно
+            event.events = EPOLLIN | EPOLLONESHOT;
+            if (epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, connection->socket, &event) == 0) {
+                continue;
+            }
+            status = -1;
+        }
+
+        if (status < 0) {
+            publishLostConnectionMessage(connection->gardener_id);
+        }
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, connection->socket, NULL);
+        countMetric(&metrics->gardeners_connected, -1);
+        close(connection->socket);
+        free(connection);
+    }
+}
+
+// Однопроцессный сервер: все соединения садовников обслуживаются threads потоками через epoll
+void runEpollServer(int server_socket, sem_t *semaphores, int *field,
+                    struct FieldSize field_size, int threads) {
+    struct EpollServer *server = malloc(sizeof(struct EpollServer));
+    if (server == NULL || (server->epoll_fd = epoll_create1(0)) < 0) {
+        perror("Unable to create epoll instance");
+        exit(-1);
+    }
+    server->semaphores = semaphores;
+    server->field = field;
+    server->field_size = field_size;
+
+    for (int i = 0; i < threads; ++i) {
+        pthread_t worker;
+        if (pthread_create(&worker, NULL, runEpollWorker, (void *)server) != 0) {
+            perror("Unable to create epoll worker");
+            exit(-1);
+        }
+        pthread_detach(worker);
+    }
+
+    while (1) {
+        int client_socket = acceptClientConnection(server_socket, S_INFO);
+        struct timespec accepted_at;
+        clock_gettime(CLOCK_MONOTONIC, &accepted_at);
+        if (greetGardener(client_socket, field_size) < 0) {
+            close(client_socket);
+            continue;
+        }
+        fcntl(client_socket, F_SETFL, fcntl(client_socket, F_GETFL) | O_NONBLOCK);
+
+        struct Connection *connection = malloc(sizeof(struct Connection));
+        if (connection == NULL) {
+            perror("Unable to allocate connection");
+            exit(-1);
+        }
+        connection->socket = client_socket;
+        connection->gardener_id = 0;
+        connection->acknowledged = 0;
+        connection->accepted_at = accepted_at;
+        connection->received = 0;
+
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.ptr = connection;
+        countMetric(&metrics->gardeners_connected, 1);
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, client_socket, &event) < 0) {
+            perror("Unable to add connection to epoll");
+            countMetric(&metrics->gardeners_connected, -1);
+            close(client_socket);
+            free(connection);
+        }
+    }
+}
+
+int *getField(size_t field_size) {
+    int *field;
+    int shmid;
+
+    if ((shmid = shm_open(shared_object, O_CREAT | O_RDWR, 0666)) < 0) {
+        perror("Can't connect to shared memory");
+        exit(-1);
+    } else {
+        if (ftruncate(shmid, field_size * sizeof(int)) < 0) {
+            perror("Can't resize shared memory");
+            exit(-1);
+        }
+        if ((field = mmap(0, field_size * sizeof(int), PROT_WRITE | PROT_READ, MAP_SHARED, shmid,
+                          0)) < 0) {
+            printf("Can't connect to shared memory\n");
+            exit(-1);
+        };
+    }
+
+    return field;
+}
+
+int *getOccupants(size_t count) {
+    int *occupied;
+    int shmid;
+
+    if ((shmid = shm_open(occupants_shared_object, O_CREAT | O_RDWR, 0666)) < 0) {
+        perror("Can't connect to shared memory");
+        exit(-1);
+    }
+    if (ftruncate(shmid, count * sizeof(int)) < 0) {
+        perror("Can't resize shared memory");
+        exit(-1);
+    }
+    if ((occupied = mmap(0, count * sizeof(int), PROT_WRITE | PROT_READ, MAP_SHARED, shmid, 0)) ==
+        MAP_FAILED) {
+        perror("Can't connect to shared memory");
+        exit(-1);
+    }
+
+    return occupied;
+}
+
+// Планировщик виртуального времени с билетными блокировками зон. mutex и условная переменная
+// разделяются между процессами садовников
+struct VirtualClock *getVirtualClock(int zones, int expected) {
+    struct VirtualClock *clock;
+    int shmid;
+    size_t size = sizeof(struct VirtualClock) + zones * sizeof(struct VirtualZone);
+
+    if ((shmid = shm_open(clock_shared_object, O_CREAT | O_RDWR, 0666)) < 0) {
+        perror("Can't connect to shared memory");
+        exit(-1);
+    }
+    if (ftruncate(shmid, 0) < 0 || ftruncate(shmid, size) < 0) {
+        perror("Can't resize shared memory");
+        exit(-1);
+    }
+    if ((clock = mmap(0, size, PROT_WRITE | PROT_READ, MAP_SHARED, shmid, 0)) == MAP_FAILED) {
+        perror("Can't connect to shared memory");
+        exit(-1);
+    }
+
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&clock->mutex, &mutex_attr);
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&clock->changed, &cond_attr);
+    clock->expected = expected;
+    clock->runnable = expected;
+
+    return clock;
+}
+
+// Кольцо событий: в ячейке i ждется запись с номером i
+struct EventRing *getEventRing() {
+    struct EventRing *ring;
+    int shmid;
+
+    if ((shmid = shm_open(events_shared_object, O_CREAT | O_RDWR, 0666)) < 0) {
+        perror("Can't connect to shared memory");
+        exit(-1);
+    }
+    if (ftruncate(shmid, 0) < 0 || ftruncate(shmid, sizeof(struct EventRing)) < 0) {
+        perror("Can't resize shared memory");
+        exit(-1);
+    }
+    if ((ring = mmap(0, sizeof(struct EventRing), PROT_WRITE | PROT_READ, MAP_SHARED, shmid, 0)) ==
+        MAP_FAILED) {
+        perror("Can't connect to shared memory");
+        exit(-1);
+    }
+
+    for (unsigned int i = 0; i < EVENT_RING_SIZE; ++i) {
+        ring->slots[i].sequence = i;
+    }
+    return ring;
+}
+
+// Блок метрик создается заново при каждом запуске сервера, поэтому счетчики начинаются с нуля
+struct Metrics *getMetrics() {
+    struct Metrics *block;
+    int shmid;
+
+    if ((shmid = shm_open(metrics_shared_object, O_CREAT | O_RDWR, 0666)) < 0) {
+        perror("Can't connect to shared memory");
+        exit(-1);
+    }
+    if (ftruncate(shmid, 0) < 0 || ftruncate(shmid, sizeof(struct Metrics)) < 0) {
+        perror("Can't resize shared memory");
+        exit(-1);
+    }
+    if ((block = mmap(0, sizeof(struct Metrics), PROT_WRITE | PROT_READ, MAP_SHARED, shmid, 0)) ==
+        MAP_FAILED) {
+        perror("Can't connect to shared memory");
+        exit(-1);
+    }
+    return block;
+}
+
+// Профиль конкуренции: заголовок, счетчики zones зон поля и номера занявших locks блокировок
+struct Contention *getContention(long zones, long locks) {
+    struct Contention *block;
+    size_t size = sizeof(struct Contention) + zones * sizeof(struct ZoneContention) +
+                  locks * sizeof(int);
+    int shmid;
+
+    if ((shmid = shm_open(contention_shared_object, O_CREAT | O_RDWR, 0666)) < 0) {
+        perror("Can't connect to shared memory");
+        exit(-1);
+    }
+    if (ftruncate(shmid, 0) < 0 || ftruncate(shmid, size) < 0) {
+        perror("Can't resize shared memory");
+        exit(-1);
+    }
+    if ((block = mmap(0, size, PROT_WRITE | PROT_READ, MAP_SHARED, shmid, 0)) == MAP_FAILED) {
+        perror("Can't connect to shared memory");
+        exit(-1);
+    }
+    return block;
+}
+
+uint64_t *getBitmaps(size_t words) {
+    uint64_t *bitmaps;
+    int shmid;
+
+    if ((shmid = shm_open(bitmaps_shared_object, O_CREAT | O_RDWR, 0666)) < 0) {
+        perror("Can't connect to shared memory");
+        exit(-1);
+    }
+    if (ftruncate(shmid, 0) < 0 || ftruncate(shmid, words * sizeof(uint64_t)) < 0) {
+        perror("Can't resize shared memory");
+        exit(-1);
+    }
+    if ((bitmaps = mmap(0, words * sizeof(uint64_t), PROT_WRITE | PROT_READ, MAP_SHARED, shmid,
+                        0)) == MAP_FAILED) {
+        perror("Can't connect to shared memory");
+        exit(-1);
+    }
+
+    return bitmaps;
+}
+
+// Версии участков начинаются с нуля: ftruncate до нуля сбрасывает память прошлого запуска
+struct TileVersion *getTileVersions(long tiles) {
+    struct TileVersion *versions;
+    int shmid;
+
+    if ((shmid = shm_open(versions_shared_object, O_CREAT | O_RDWR, 0666)) < 0) {
+        perror("Can't connect to shared memory");
+        exit(-1);
+    }
+    if (ftruncate(shmid, 0) < 0 || ftruncate(shmid, tiles * sizeof(struct TileVersion)) < 0) {
+        perror("Can't resize shared memory");
+        exit(-1);
+    }
+    if ((versions = mmap(0, tiles * sizeof(struct TileVersion), PROT_WRITE | PROT_READ,
+                         MAP_SHARED, shmid, 0)) == MAP_FAILED) {
+        perror("Can't connect to shared memory");
+        exit(-1);
+    }
+
+    return versions;
+}
+
+struct SharedState *getSharedState() {
+    struct SharedState *state;
+    int shmid;
+
+    if ((shmid = shm_open(state_shared_object, O_CREAT | O_RDWR, 0666)) < 0) {
+        perror("Can't connect to shared memory");
+        exit(-1);
+    }
+    if (ftruncate(shmid, sizeof(struct SharedState)) < 0) {
+        perror("Can't resize shared memory");
+        exit(-1);
+    }
+    if ((state = mmap(0, sizeof(struct SharedState), PROT_WRITE | PROT_READ, MAP_SHARED, shmid,
+                      0)) == MAP_FAILED) {
+        perror("Can't connect to shared memory");
+        exit(-1);
+    }
+
+    return state;
+}
+
+void initializeField(int *field, int rows, int columns) {
+    for (int i = 0; i < rows; ++i) {
+        for (int j = 0; j < columns; ++j) {
+            field[i * columns + j] = 0;
+        }
+    }
+
+    int percentage = 10 + random() % 20;
+    long count_of_bad_plots = (long)columns * rows * percentage / 100;
+    for (long i = 0; i < count_of_bad_plots; ++i) {
+        int row_index;
+        int column_index;
+        do {
+            row_index = random() % rows;
+            column_index = random() % columns;
+        } while (field[row_index * columns + column_index] == -1);
+
+        field[row_index * columns + column_index] = -1;
     }
 }
 
@@ -375,92 +1943,719 @@ void createSemaphores(sem_t *semaphores, int count) {
     }
 }
 
-sem_t *createSemaphoresSharedMemory(int sem_count) {
-    int sem_main_shmid;
-    sem_t *semaphores;
-
-    if ((sem_main_shmid = shm_open(sem_shared_object, O_CREAT | O_RDWR, 0666)) < 0) {
-        perror("Can't connect to shared memory");
-        exit(-1);
-    } else {
-        if (ftruncate(sem_main_shmid, sem_count * sizeof(sem_t)) < 0) {
-            perror("Can't rezie shm");
-            exit(-1);
+sem_t *createSemaphoresSharedMemory(int sem_count) {
+    int sem_main_shmid;
+    sem_t *semaphores;
+
+    if ((sem_main_shmid = shm_open(sem_shared_object, O_CREAT | O_RDWR, 0666)) < 0) {
+        perror("Can't connect to shared memory");
+        exit(-1);
+    } else {
+        if (ftruncate(sem_main_shmid, sem_count * sizeof(sem_t)) < 0) {
+            perror("Can't rezie shm");
+            exit(-1);
+        }
+        if ((semaphores = mmap(0, sem_count * sizeof(sem_t), PROT_WRITE | PROT_READ, MAP_SHARED,
+                               sem_main_shmid, 0)) < 0) {
+            printf("Can\'t connect to shared memory\n");
+            exit(-1);
+        };
+    }
+
+    return semaphores;
+}
+
+// Реестр наблюдателей: слоты по номерам (номер не меняется, пока наблюдатель подключен, и
+// передается в epoll), стек свободных номеров и плотный массив номеров подключенных
+// наблюдателей, чтобы рассылка не проходила по пустым слотам. Реестр растет удвоением.
+// Все обращения - под семафором наблюдателей
+struct ObserverRegistry {
+    struct Observer *slots;
+    int *free_ids;
+    int free_count;
+    int *active;
+    int *active_position;  // место номера в active
+    int active_count;
+    int capacity;
+};
+
+#define OBSERVERS_INITIAL 16
+
+struct ObserverRegistry registry;
+
+int growObserverRegistry() {
+    int capacity = registry.capacity > 0 ? registry.capacity * 2 : OBSERVERS_INITIAL;
+    struct Observer *slots = realloc(registry.slots, capacity * sizeof(struct Observer));
+    if (slots == NULL) {
+        return -1;
+    }
+    registry.slots = slots;
+    int *free_ids = realloc(registry.free_ids, capacity * sizeof(int));
+    if (free_ids == NULL) {
+        return -1;
+    }
+    registry.free_ids = free_ids;
+    int *active = realloc(registry.active, capacity * sizeof(int));
+    if (active == NULL) {
+        return -1;
+    }
+    registry.active = active;
+    int *active_position = realloc(registry.active_position, capacity * sizeof(int));
+    if (active_position == NULL) {
+        return -1;
+    }
+    registry.active_position = active_position;
+
+    // Меньшие номера выдаются первыми
+    for (int id = capacity - 1; id >= registry.capacity; --id) {
+        registry.slots[id].is_active = 0;
+        registry.slots[id].generation = 0;
+        registry.free_ids[registry.free_count++] = id;
+    }
+    registry.capacity = capacity;
+    return 0;
+}
+
+// Возвращает номер наблюдателя или -1, если не хватило памяти
+int addObserver(struct Observer observer) {
+    if (registry.free_count == 0 && growObserverRegistry() < 0) {
+        return -1;
+    }
+    int id = registry.free_ids[--registry.free_count];
+    observer.generation = registry.slots[id].generation + 1;
+    registry.slots[id] = observer;
+    registry.active_position[id] = registry.active_count;
+    registry.active[registry.active_count++] = id;
+    return id;
+}
+
+// Удаление из плотного массива переносит на место наблюдателя последний элемент, поэтому
+// обход с удалением идет от конца массива
+void releaseObserver(int id) {
+    int position = registry.active_position[id];
+    int last = registry.active[--registry.active_count];
+    registry.active[position] = last;
+    registry.active_position[last] = position;
+    registry.slots[id].is_active = 0;
+    registry.free_ids[registry.free_count++] = id;
+}
+
+// Данные события epoll: номер наблюдателя и поколение слота
+uint64_t observerTag(int id) {
+    return (uint64_t)registry.slots[id].generation << 32 | (unsigned int)id;
+}
+
+// Наблюдатель по данным события epoll или NULL, если слот уже освобожден или занят другим
+struct Observer *taggedObserver(uint64_t tag) {
+    unsigned int id = (unsigned int)tag;
+    if (id >= (unsigned int)registry.capacity) {
+        return NULL;
+    }
+    struct Observer *observer = registry.slots + id;
+    if (observer->is_active != 1 || observer->generation != (unsigned int)(tag >> 32)) {
+        return NULL;
+    }
+    return observer;
+}
+
+#define FANOUT_WAKEUP_TAG UINT64_MAX
+
+struct Args {
+    int socket;
+    sem_t *sem;
+    int *field;
+    struct FieldSize field_size;
+    int queue_capacity;
+    enum slow_policy policy;
+};
+
+// Упаковка count клеток копии участка поля по bits бит на клетку. bits проверен по наибольшему
+// номеру садовника в этой же копии, поэтому все коды помещаются без обрезки
+void packField(unsigned char *out, const int *cells, long count, int bits) {
+    if (bits == 2) {
+        long k = 0;
+        for (; k + 4 <= count; k += 4) {
+            out[k / 4] = (unsigned char)((cells[k] + 1) | (cells[k + 1] + 1) << 2 |
+                                         (cells[k + 2] + 1) << 4 | (cells[k + 3] + 1) << 6);
+        }
+        if (k < count) {
+            unsigned char last = 0;
+            for (int shift = 0; k < count; ++k, shift += 2) {
+                last |= (unsigned char)((cells[k] + 1) << shift);
+            }
+            out[(count - 1) / 4] = last;
+        }
+    } else if (bits == 8) {
+        for (long k = 0; k < count; ++k) {
+            out[k] = (unsigned char)(cells[k] + 1);
+        }
+    } else {
+        for (long k = 0; k < count; ++k) {
+            ((unsigned int *)out)[k] = (unsigned int)(cells[k] + 1);
+        }
+    }
+}
+
+// Размер упакованных клеток в байтах
+long packedSize(long count, int bits) {
+    return (count * bits + 7) / 8;
+}
+
+// Число бит на клетку снимка, достаточное для садовника с номером gardener_id
+int snapshotBits(int gardener_id) {
+    return gardener_id <= 2 ? 2 : gardener_id <= 254 ? 8 : 32;
+}
+
+// Ширина клетки в последнем снимке. Снимки строит только поток рассылки, а номера садовников
+// на поле только растут, поэтому следующий снимок начинается с нее
+int snapshot_bits = 2;
+
+// Полный снимок поля в упакованном виде вместе с заголовками сообщения. Поле копируется
+// и упаковывается по участкам, садовники при этом не ждут. Если в участке встретился садовник,
+// не помещающийся в ширину клетки, упаковка начинается заново с большей шириной. В снимок
+// входят все изменения до sequence и, возможно, часть более поздних: их наблюдатель применит
+// повторно
+unsigned char *buildSnapshot(int *field, struct FieldSize field_size, long long sequence,
+                             long *size) {
+    long cells = (long)field_size.rows * field_size.columns;
+    int tile[TILE_CELLS];
+    unsigned char *buffer = NULL;
+
+    while (1) {
+        struct SnapshotHeader snapshot;
+        snapshot.sequence = sequence;
+        snapshot.rows = field_size.rows;
+        snapshot.columns = field_size.columns;
+        snapshot.bits_per_cell = snapshot_bits;
+
+        struct MessageHeader header;
+        header.type = SNAPSHOT_MESSAGE;
+        header.length = sizeof(snapshot) + packedSize(cells, snapshot.bits_per_cell);
+
+        *size = sizeof(header) + header.length;
+        unsigned char *resized = realloc(buffer, *size);
+        if (resized == NULL) {
+            free(buffer);
+            return NULL;
+        }
+        buffer = resized;
+        memcpy(buffer, &header, sizeof(header));
+        memcpy(buffer + sizeof(header), &snapshot, sizeof(snapshot));
+
+        unsigned char *packed = buffer + sizeof(header) + sizeof(snapshot);
+        long first = 0;
+        for (; first < cells; first += TILE_CELLS) {
+            long count = cells - first < TILE_CELLS ? cells - first : TILE_CELLS;
+            copyCells(tile, field, first, count);
+            int bits = snapshotBits(fieldMaxValue(tile, count));
+            if (bits > snapshot_bits) {
+                snapshot_bits = bits;
+                break;
+            }
+            packField(packed + first * snapshot_bits / 8, tile, count, snapshot_bits);
+        }
+        if (first >= cells) {
+            return buffer;
+        }
+    }
+}
+
+// Копирование в кольцевой буфер очереди и из него с учетом перехода через конец
+void copyToQueue(struct OutputQueue *queue, int position, const void *data, int size) {
+    int first = queue->capacity - position < size ? queue->capacity - position : size;
+    memcpy(queue->data + position, data, first);
+    memcpy(queue->data, (const char *)data + first, size - first);
+}
+
+void copyFromQueue(struct OutputQueue *queue, int position, void *data, int size) {
+    int first = queue->capacity - position < size ? queue->capacity - position : size;
+    memcpy(data, queue->data + position, first);
+    memcpy((char *)data + first, queue->data, size - first);
+}
+
+// Размер сообщения, которое начинается в позиции position очереди
+int queuedMessageSize(struct OutputQueue *queue, int position) {
+    struct MessageHeader header;
+    copyFromQueue(queue, position, &header, sizeof(header));
+    return sizeof(header) + header.length;
+}
+
+struct OutputQueue *createOutputQueue(int capacity) {
+    struct OutputQueue *queue = calloc(1, sizeof(struct OutputQueue));
+    if (queue == NULL || (queue->data = malloc(capacity)) == NULL) {
+        perror("Unable to allocate observer queue");
+        exit(-1);
+    }
+    queue->capacity = capacity;
+    // Новый наблюдатель первым делом получает снимок поля
+    queue->needs_snapshot = 1;
+    return queue;
+}
+
+void removeObserver(struct Observer *observer) {
+    releaseObserver(observer - registry.slots);
+    countMetric(&metrics->observers_connected, -1);
+    close(observer->socket);
+    free(observer->queue->data);
+    free(observer->queue->snapshot);
+    free(observer->queue);
+    observer->queue = NULL;
+    printf("Observer disconnected\n");
+}
+
+// Очередь заменяется снимком поля. Недоотправленный остаток сообщения сохраняется,
+// чтобы не разорвать поток
+void resetToSnapshot(struct OutputQueue *queue) {
+    queue->size = queue->partial;
+    queue->needs_snapshot = 1;
+}
+
+void dropMessage(struct OutputQueue *queue) {
+    queue->dropped++;
+    countMetric(&metrics->events_dropped, 1);
+}
+
+// Постановка сообщения в очередь наблюдателя. При переполнении действует политика policy:
+// отбросить самые старые сообщения, отключить наблюдателя или заменить очередь снимком поля.
+// Вызывается под семафором наблюдателей
+void enqueueMessage(struct Observer *observer, enum slow_policy policy, int type,
+                    const void *data, unsigned int length) {
+    struct OutputQueue *queue = observer->queue;
+    int size = sizeof(struct MessageHeader) + length;
+
+    // Очередь уже сброшена, все изменения до снимка в него и попадут
+    if (queue->needs_snapshot) {
+        return;
+    }
+
+    while (queue->capacity - queue->size < size) {
+        if (policy == DISCONNECT_SLOW) {
+            removeObserver(observer);
+            return;
+        }
+        if (policy == SNAPSHOT_SLOW) {
+            resetToSnapshot(queue);
+            dropMessage(queue);
+            return;
+        }
+        // Сообщение, которое уже начали отправлять, выбросить нельзя
+        if (queue->partial > 0 || queue->size == 0) {
+            dropMessage(queue);
+            return;
+        }
+        int oldest = queuedMessageSize(queue, queue->head);
+        queue->head = (queue->head + oldest) % queue->capacity;
+        queue->size -= oldest;
+        dropMessage(queue);
+    }
+
+    struct MessageHeader header;
+    header.type = type;
+    header.length = length;
+    int tail = (queue->head + queue->size) % queue->capacity;
+    copyToQueue(queue, tail, &header, sizeof(header));
+    copyToQueue(queue, (tail + sizeof(header)) % queue->capacity, data, length);
+    queue->size += size;
+}
+
+// Наблюдатели, ждущие снимка. Список ведет только поток рассылки
+uint64_t *snapshot_requests = NULL;
+int snapshot_request_count = 0;
+int snapshot_request_capacity = 0;
+
+void addSnapshotRequest(uint64_t tag) {
+    if (snapshot_request_count == snapshot_request_capacity) {
+        int capacity = snapshot_request_capacity > 0 ? snapshot_request_capacity * 2 : 16;
+        uint64_t *requests = realloc(snapshot_requests, capacity * sizeof(uint64_t));
+        if (requests == NULL) {
+            perror("Unable to allocate snapshot requests");
+            exit(-1);
+        }
+        snapshot_requests = requests;
+        snapshot_request_capacity = capacity;
+    }
+    snapshot_requests[snapshot_request_count++] = tag;
+}
+
+// Неблокирующая отправка накопленного наблюдателю: сначала снимок, если он есть, затем очередь.
+// Возвращает -1, если соединение с наблюдателем потеряно. Вызывается под семафором наблюдателей
+int flushObserver(struct Observer *observer) {
+    struct OutputQueue *queue = observer->queue;
+    while (1) {
+        const char *data;
+        long size;
+        if (queue->snapshot != NULL) {
+            data = (const char *)queue->snapshot + queue->snapshot_sent;
+            size = queue->snapshot_size - queue->snapshot_sent;
+        } else if (queue->size > 0) {
+            data = queue->data + queue->head;
+            size = queue->capacity - queue->head < queue->size ? queue->capacity - queue->head
+                                                               : queue->size;
+        } else if (queue->needs_snapshot) {
+            // Снимок строится позже, без семафора наблюдателей (buildPendingSnapshots)
+            if (!queue->snapshot_pending) {
+                queue->snapshot_pending = 1;
+                addSnapshotRequest(observerTag(observer - registry.slots));
+            }
+            return 0;
+        } else {
+            return 0;
+        }
+
+        int bytes = send(observer->socket, data, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (bytes <= 0) {
+            return -1;
+        }
+
+        if (queue->snapshot != NULL) {
+            queue->snapshot_sent += bytes;
+            if (queue->snapshot_sent == queue->snapshot_size) {
+                free(queue->snapshot);
+                queue->snapshot = NULL;
+                observer->is_new = 0;
+            }
+            continue;
+        }
+
+        // Продвижение по границам сообщений, чтобы знать, сколько осталось от текущего
+        while (bytes > 0) {
+            if (queue->partial == 0) {
+                queue->partial = queuedMessageSize(queue, queue->head);
+            }
+            int taken = bytes < queue->partial ? bytes : queue->partial;
+            queue->head = (queue->head + taken) % queue->capacity;
+            queue->size -= taken;
+            queue->partial -= taken;
+            bytes -= taken;
+        }
+    }
+}
+
+// Последние изменения клеток по номеру изменения: изменение s лежит в ячейке s % DELTA_HISTORY.
+// Пишет поток writer, читает поток рассылки, оба под семафором наблюдателей
+struct Delta delta_history[DELTA_HISTORY];
+long long history_last = 0;
+
+void rememberDelta(struct Delta delta) {
+    delta_history[delta.sequence % DELTA_HISTORY] = delta;
+    if (delta.sequence > history_last) {
+        history_last = delta.sequence;
+    }
+}
+
+// Повторная отправка изменений после номера sequence. Если часть из них уже вытеснена
+// из истории или их слишком много для очереди, наблюдатель получает новый снимок. Изменения, которые еще не дошли до writer,
+// придут обычным путем. Вызывается под семафором наблюдателей
+void resyncObserver(struct Observer *observer, enum slow_policy policy, long long sequence) {
+    struct OutputQueue *queue = observer->queue;
+    // Снимок еще впереди, и он покроет все пропущенное
+    if (observer->is_new || queue->needs_snapshot) {
+        return;
+    }
+    // Снимок дешевле, если изменения вытеснены из истории или не поместятся в очередь
+    long long missing = history_last - sequence;
+    if (missing > DELTA_HISTORY ||
+        missing * (long long)(sizeof(struct MessageHeader) + sizeof(struct Delta)) >
+            queue->capacity - queue->size) {
+        resetToSnapshot(queue);
+        return;
+    }
+    for (long long s = sequence + 1; s <= history_last && observer->is_active; ++s) {
+        struct Delta *delta = delta_history + s % DELTA_HISTORY;
+        if (delta->sequence == s) {
+            enqueueMessage(observer, policy, DELTA_MESSAGE, delta, sizeof(*delta));
+        }
+    }
+}
+
+// Прикрепление снимка, построенного без семафора. Изменения с номерами больше sequence,
+// которые writer успел обработать за это время, берутся из истории, остальные writer положит
+// в очередь сам. Возвращает -1, если их уже нет в истории или они не помещаются в очередь.
+// Вызывается под семафором наблюдателей
+int attachSnapshot(struct Observer *observer, enum slow_policy policy, unsigned char *snapshot,
+                   long size, long long sequence) {
+    struct OutputQueue *queue = observer->queue;
+    long long missing = history_last - sequence;
+    if (missing > DELTA_HISTORY ||
+        missing * (long long)(sizeof(struct MessageHeader) + sizeof(struct Delta)) >
+            queue->capacity - queue->size) {
+        return -1;
+    }
+    queue->snapshot = snapshot;
+    queue->snapshot_size = size;
+    queue->snapshot_sent = 0;
+    queue->sequence = sequence;
+    queue->needs_snapshot = 0;
+    queue->snapshot_pending = 0;
+    for (long long s = sequence + 1; s <= history_last && observer->is_active; ++s) {
+        struct Delta *delta = delta_history + s % DELTA_HISTORY;
+        if (delta->sequence == s) {
+            enqueueMessage(observer, policy, DELTA_MESSAGE, delta, sizeof(*delta));
+        }
+    }
+    return 0;
+}
+
+// Чтение запросов наблюдателя до опустошения сокета. Возвращает -1, если соединение
+// потеряно или запрос не распознан
+int readObserverRequests(struct Observer *observer, enum slow_policy policy) {
+    while (observer->is_active) {
+        int bytes = recv(observer->socket, observer->request + observer->request_received,
+                         sizeof(observer->request) - observer->request_received, MSG_DONTWAIT);
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (bytes <= 0) {
+            return -1;
+        }
+        observer->request_received += bytes;
+        if (observer->request_received < (int)sizeof(observer->request)) {
+            continue;
+        }
+
+        struct MessageHeader header;
+        struct ResyncRequest request;
+        memcpy(&header, observer->request, sizeof(header));
+        memcpy(&request, observer->request + sizeof(header), sizeof(request));
+        observer->request_received = 0;
+        if (header.type != RESYNC_REQUEST || header.length != sizeof(request)) {
+            return -1;
+        }
+        resyncObserver(observer, policy, request.sequence);
+    }
+    return 0;
+}
+
+int fanout_event_fd;
+int fanout_epoll_fd;
+
+// Построение снимков для ждущих наблюдателей. Поле копируется без семафора наблюдателей,
+// поэтому writer продолжает разбирать кольцо и садовники не ждут в writeEvent. Номер
+// изменения берется до копии: все изменения до него уже на поле. Если снимок не удалось
+// прикрепить, он строится заново
+void buildPendingSnapshots(struct Args *data) {
+    while (snapshot_request_count > 0) {
+        uint64_t tag = snapshot_requests[--snapshot_request_count];
+        long long sequence = __atomic_load_n(&shared_state->sequence, __ATOMIC_SEQ_CST);
+        long size;
+        unsigned char *snapshot = buildSnapshot(data->field, data->field_size, sequence, &size);
+
+        sem_wait(data->sem);
+        struct Observer *observer = taggedObserver(tag);
+        if (observer == NULL) {
+            free(snapshot);
+        } else if (snapshot == NULL) {
+            removeObserver(observer);
+        } else if (attachSnapshot(observer, data->policy, snapshot, size, sequence) < 0) {
+            free(snapshot);
+            addSnapshotRequest(tag);
+        } else if (observer->is_active == 1 && flushObserver(observer) < 0) {
+            removeObserver(observer);
+        }
+        sem_post(data->sem);
+    }
+}
+
+// Поток рассылки: ждет новых сообщений от writer и готовности сокетов наблюдателей к записи
+void *runObserverFanout(void *args) {
+    struct Args data = *((struct Args *)args);
+    while (1) {
+        struct epoll_event events[64];
+        int count = epoll_wait(fanout_epoll_fd, events, 64, -1);
+        if (count < 0 && errno == EINTR) {
+            continue;
         }
-        if ((semaphores = mmap(0, sem_count * sizeof(sem_t), PROT_WRITE | PROT_READ, MAP_SHARED,
-                               sem_main_shmid, 0)) < 0) {
-            printf("Can\'t connect to shared memory\n");
+        if (count < 0) {
+            perror("epoll_wait failed");
             exit(-1);
-        };
-    }
+        }
 
-    return semaphores;
+        int flush_all = 0;
+        for (int k = 0; k < count; ++k) {
+            if (events[k].data.u64 == FANOUT_WAKEUP_TAG) {
+                uint64_t value;
+                read(fanout_event_fd, &value, sizeof(value));
+                flush_all = 1;
+            }
+        }
+
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        sem_wait(data.sem);
+        for (int k = 0; k < count; ++k) {
+            if (events[k].data.u64 == FANOUT_WAKEUP_TAG) {
+                continue;
+            }
+            // Слот мог освободиться и достаться новому наблюдателю после epoll_wait
+            struct Observer *observer = taggedObserver(events[k].data.u64);
+            if (observer == NULL) {
+                continue;
+            }
+            if (events[k].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP) ||
+                (events[k].events & EPOLLIN &&
+                 readObserverRequests(observer, data.policy) < 0) ||
+                (observer->is_active == 1 && flushObserver(observer) < 0)) {
+                removeObserver(observer);
+            }
+        }
+        for (int k = registry.active_count - 1; flush_all && k >= 0; --k) {
+            struct Observer *observer = registry.slots + registry.active[k];
+            if (flushObserver(observer) < 0) {
+                removeObserver(observer);
+            }
+        }
+        sem_post(data.sem);
+        buildPendingSnapshots(&data);
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    }
 }
 
-struct Observer *observers;
+// Пробуждение потока рассылки
+void wakeObserverFanout() {
+    uint64_t value = 1;
+    write(fanout_event_fd, &value, sizeof(value));
+}
 
 void *writeInfoToConsole(void *args) {
-    sem_t *sem = (sem_t *)args;
+    struct Args data = *((struct Args *)args);
+    sem_t *sem = data.sem;
     while (1) {
         struct Event event;
-        if (read(pipe_fd[0], &event, sizeof(event)) < 0) {
-            perror("Can't read from pipe");
-            exit(-1);
+        long long timeout_ns = -1;
+        if (journal_fd >= 0 && journal_used > 0) {
+            long long now = monotonicNanoseconds() - server_started_at;
+            timeout_ns = journal_flushed_at + 1000000000LL - now;
+            timeout_ns = timeout_ns > 0 ? timeout_ns : 0;
+        }
+        if (readEvent(&event, timeout_ns) < 0) {
+            flushJournal();
+            journal_flushed_at = monotonicNanoseconds() - server_started_at;
+            continue;
+        }
+        if (event.type == STOP) {
+            return NULL;
         }
-        if (event.type == MAP || event.type == S_INFO) {
-            printf("%s\n", event.buffer);
+        if (journal_fd >= 0) {
+            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+            appendJournal(&event);
+            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        }
+        // Части карты выводятся подряд, перевод строки добавляется только после последней
+        const char *format = event.type == MAP_CHUNK ? "%s" : "%s\n";
+        char timestamp[32];
+        formatTimestamp(timestamp, event.timestamp);
+        if (event.type == S_INFO || event.type == S_CONSOLE) {
+            printf("%s", timestamp);
+        }
+        if (event.type == MAP || event.type == MAP_CHUNK || event.type == S_INFO ||
+            event.type == S_CONSOLE) {
+            printf(format, event.buffer);
+        }
+        if (event.type == DELTA &&
+            (long)data.field_size.rows * data.field_size.columns <= CONSOLE_MAP_LIMIT) {
+            int copy[CONSOLE_MAP_LIMIT];
+            copyCells(copy, data.field, 0, (long)data.field_size.rows * data.field_size.columns);
+            printf("\n");
+            printField(copy, data.field_size.columns, data.field_size.rows);
+            printf("\n");
+        }
+
+        // Полная карта наблюдателям не пересылается: они получают снимок при подключении
+        // и дальше только изменения клеток
+        if (event.type == MAP || event.type == MAP_CHUNK || event.type == S_CONSOLE) {
+            continue;
+        }
+
+        char buffer[sizeof(timestamp) + sizeof(event.buffer) + 3];
+        int type = TEXT_MESSAGE;
+        void *message = buffer;
+        unsigned int size;
+        if (event.type == DELTA) {
+            type = DELTA_MESSAGE;
+            message = &event.delta;
+            size = sizeof(event.delta);
+        } else {
+            int offset = sprintf(buffer, "%s", timestamp);
+            size = offset + sprintf(buffer + offset, format, event.buffer);
         }
-        char buffer[sizeof(event.timestamp) + sizeof(event.buffer) + 3];
-        int size = sprintf(buffer, "%s\n", event.buffer);
+
+        // Сообщение только кладется в очереди наблюдателей, отправляет его поток рассылки,
+        // поэтому медленный наблюдатель не задерживает события
         pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
         sem_wait(sem);
-        for (int i = 0; i < 100; ++i) {
-            if (observers[i].is_active == 1) {
-                if (send(observers[i].socket, buffer, size, MSG_NOSIGNAL) <= 0) {
-                    observers[i].is_active = 0;
-                    close(observers[i].socket);
-                    printf("Observer disconnected\n");
-                }
+        if (event.type == DELTA) {
+            rememberDelta(event.delta);
+        }
+        for (int k = registry.active_count - 1; k >= 0; --k) {
+            // Изменения, уже вошедшие в снимок наблюдателя, ему не отправляются
+            struct Observer *observer = registry.slots + registry.active[k];
+            if (event.type != DELTA || event.delta.sequence > observer->queue->sequence) {
+                enqueueMessage(observer, data.policy, type, message, size);
             }
         }
         sem_post(sem);
         pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        wakeObserverFanout();
     }
 }
 
 pthread_t writer_thread;
-void runWriter(sem_t *sem) {
-    pthread_create(&writer_thread, NULL, writeInfoToConsole, (void *)sem);
-}
+pthread_t fanout_thread;
+pthread_t acceptor_thread;
+void runWriter(struct Args *args) {
+    if ((fanout_epoll_fd = epoll_create1(0)) < 0 || (fanout_event_fd = eventfd(0, 0)) < 0) {
+        perror("Unable to create observer fan-out");
+        exit(-1);
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = FANOUT_WAKEUP_TAG;
+    epoll_ctl(fanout_epoll_fd, EPOLL_CTL_ADD, fanout_event_fd, &event);
 
-struct Args {
-    int socket;
-    sem_t *sem;
-};
+    pthread_create(&fanout_thread, NULL, runObserverFanout, (void *)args);
+    pthread_create(&writer_thread, NULL, writeInfoToConsole, (void *)args);
+}
 
 void *registerObservers(void *args) {
     struct Args data = *((struct Args *)args);
     while (1) {
-        int client_socket = acceptClientConnection(data.socket);
+        int client_socket = acceptClientConnection(data.socket, S_CONSOLE);
 
         struct Event finish_event;
         setEventWithCurrentTime(&finish_event);
-        finish_event.type = S_INFO;
+        finish_event.type = S_CONSOLE;
         sprintf(finish_event.buffer, "Observer connected\n");
-        writeEventToPipe(&finish_event);
+        writeEvent(&finish_event);
+
+        fcntl(client_socket, F_SETFL, fcntl(client_socket, F_GETFL) | O_NONBLOCK);
 
         struct Observer observer;
         observer.is_new = 1;
         observer.socket = client_socket;
         observer.is_active = 1;
+        observer.queue = createOutputQueue(data.queue_capacity);
+        observer.request_received = 0;
 
+        // Снимок поля отправит поток рассылки, когда сокет будет готов к записи
         pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
         sem_wait(data.sem);
-        for (int i = 0; i < 100; ++i) {
-            if (observers[i].is_active == 0) {
-                observers[i] = observer;
-                break;
+        int id = addObserver(observer);
+
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+        event.data.u64 = id >= 0 ? observerTag(id) : 0;
+        if (id < 0 || epoll_ctl(fanout_epoll_fd, EPOLL_CTL_ADD, client_socket, &event) < 0) {
+            perror("Unable to register observer");
+            if (id >= 0) {
+                releaseObserver(id);
             }
+            close(client_socket);
+            free(observer.queue->data);
+            free(observer.queue);
+        } else {
+            countMetric(&metrics->observers_connected, 1);
         }
         sem_post(data.sem);
         pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
@@ -469,18 +2664,300 @@ void *registerObservers(void *args) {
 
 pthread_t registartor_thread;
 void runObserverRegistrator(struct Args *args) {
-    struct Observer observer;
-    observer.is_active = 0;
-    for (int i = 0; i < 100; ++i) {
-        observers[i] = observer;
+    if (growObserverRegistry() < 0) {
+        perror("Unable to allocate observer registry");
+        exit(-1);
     }
 
     pthread_create(&registartor_thread, NULL, registerObservers, (void *)args);
 }
 
+// Метрики в текстовом формате Prometheus: каждый поступивший запрос получает ответ HTTP/1.0
+// со всеми счетчиками, после чего соединение закрывается
+int metrics_socket = -1;
+pthread_t metrics_thread;
+
+void printHistogramMetric(FILE *out, const char *name, const char *help,
+                          const struct Histogram *histogram) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    // Последняя корзина собирает все, что длиннее, поэтому она выводится как +Inf. Сумма
+    // корзин заменяет count, чтобы значения оставались согласованными при параллельной записи
+    unsigned long long cumulative = 0;
+    for (int k = 0; k < METRICS_BUCKETS - 1; ++k) {
+        cumulative += __atomic_load_n(histogram->buckets + k, __ATOMIC_RELAXED);
+        fprintf(out, "%s_bucket{le=\"%.9g\"} %llu\n", name, (double)(2ULL << k) / 1e9,
+                cumulative);
+    }
+    cumulative += __atomic_load_n(histogram->buckets + METRICS_BUCKETS - 1, __ATOMIC_RELAXED);
+    fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, cumulative);
+    fprintf(out, "%s_sum %.9f\n", name,
+            __atomic_load_n(&histogram->sum_ns, __ATOMIC_RELAXED) / 1e9);
+    fprintf(out, "%s_count %llu\n", name, cumulative);
+}
+
+void printMetric(FILE *out, const char *name, const char *type, const char *help,
+                 unsigned long long *value) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", name, help, name, type, name,
+            __atomic_load_n(value, __ATOMIC_RELAXED));
+}
+
+void writeMetricsExposition(FILE *out) {
+    printMetric(out, "garden_plots_visited_total", "counter", "Plots gardeners passed through.",
+                &metrics->plots_visited);
+    printMetric(out, "garden_plots_processed_total", "counter", "Plots processed by gardeners.",
+                &metrics->plots_processed);
+    printMetric(out, "garden_events_written_total", "counter", "Events put into the event ring.",
+                &metrics->events_written);
+    printMetric(out, "garden_observer_messages_dropped_total", "counter",
+                "Messages dropped from slow observer queues.", &metrics->events_dropped);
+    printMetric(out, "garden_event_ring_occupancy", "gauge", "Events waiting in the ring.",
+                &metrics->ring_occupancy);
+    printMetric(out, "garden_event_ring_high_water", "gauge", "Largest ring occupancy seen.",
+                &metrics->ring_high_water);
+    printMetric(out, "garden_gardeners_connected", "gauge", "Connected gardeners.",
+                &metrics->gardeners_connected);
+    printMetric(out, "garden_observers_connected", "gauge", "Connected observers.",
+                &metrics->observers_connected);
+    printMetric(out, "garden_plots", "gauge", "Plots that have to be processed.",
+                &metrics->plots_total);
+    printMetric(out, "garden_snapshot_tile_retries_total", "counter",
+                "Field tiles copied more than once because a gardener wrote to the tile.",
+                &metrics->snapshot_retries);
+    printMetric(out, "garden_tile_writes_repaired_total", "counter",
+                "Tile writes the server finished for gardener processes killed mid-write.",
+                &metrics->repaired_writes);
+
+    unsigned long long total = __atomic_load_n(&metrics->plots_total, __ATOMIC_RELAXED);
+    unsigned long long processed = __atomic_load_n(&metrics->plots_processed, __ATOMIC_RELAXED);
+    fprintf(out, "# HELP garden_field_completion_percent Processed share of the field.\n"
+                 "# TYPE garden_field_completion_percent gauge\n"
+                 "garden_field_completion_percent %.2f\n",
+            total > 0 ? 100.0 * processed / total : 100.0);
+
+    fprintf(out, "# HELP garden_gardener_plots_processed_total Plots processed by a gardener.\n"
+                 "# TYPE garden_gardener_plots_processed_total counter\n");
+    for (int id = 0; id < METRICS_GARDENERS; ++id) {
+        unsigned long long plots = __atomic_load_n(metrics->gardener_plots + id, __ATOMIC_RELAXED);
+        if (plots > 0) {
+            fprintf(out, "garden_gardener_plots_processed_total{gardener=\"%d\"} %llu\n", id,
+                    plots);
+        }
+    }
+
+    printHistogramMetric(out, "garden_zone_wait_seconds", "Time spent waiting for a zone.",
+                         &metrics->zone_wait);
+    printHistogramMetric(out, "garden_plot_seconds", "Time spent in handleGardenPlot.",
+                         &metrics->plot_time);
+    printHistogramMetric(out, "garden_recv_seconds", "Time to receive a gardener frame.",
+                         &metrics->recv_time);
+    printHistogramMetric(out, "garden_send_seconds", "Time to send a reply to a gardener.",
+                         &metrics->send_time);
+}
+
+void *serveMetrics(void *args) {
+    (void)args;
+    while (1) {
+        int client_socket = acceptClientConnection(metrics_socket, S_CONSOLE);
+
+        // Поток метрик один, поэтому клиент, который подключился и молчит, не должен
+        // задерживать остальные запросы дольше METRICS_TIMEOUT_MS
+        struct timeval timeout = {METRICS_TIMEOUT_MS / 1000, METRICS_TIMEOUT_MS % 1000 * 1000};
+        setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        // Содержимое запроса не важно: любой путь отдает метрики
+        char request[1024];
+        if (recv(client_socket, request, sizeof(request), MSG_NOSIGNAL) <= 0) {
+            close(client_socket);
+            continue;
+        }
+
+        char *body;
+        size_t length;
+        FILE *out = open_memstream(&body, &length);
+        if (out == NULL) {
+            close(client_socket);
+            continue;
+        }
+        fprintf(out, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n\r\n");
+        writeMetricsExposition(out);
+        fclose(out);
+
+        size_t sent = 0;
+        while (sent < length) {
+            ssize_t bytes = send(client_socket, body + sent, length - sent, MSG_NOSIGNAL);
+            if (bytes <= 0) {
+                break;
+            }
+            sent += bytes;
+        }
+        free(body);
+        close(client_socket);
+    }
+}
+
+void runMetricsServer(in_addr_t address, int port) {
+    metrics_socket = createServerSocket(address, port);
+    pthread_create(&metrics_thread, NULL, serveMetrics, NULL);
+}
+
+// Запись профиля конкуренции: PREFIX.csv со счетчиками по зонам, PREFIX.pgm с картой
+// суммарного времени ожидания (одна точка на зону, чем светлее, тем дольше ждали)
+// и PREFIX-gardeners.csv с числом ожиданий садовника на садовника
+const char *contention_prefix;
+struct FieldSize contention_field_size;
+
+FILE *openContentionFile(const char *suffix) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", contention_prefix, suffix);
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        perror("Unable to write contention profile");
+    }
+    return file;
+}
+
+void writeContentionProfile() {
+    int zones_in_row = (contention_field_size.columns + zone_columns - 1) / zone_columns;
+    int zones_in_column = (contention_field_size.rows + zone_rows - 1) / zone_rows;
+    long zones = (long)zones_in_row * zones_in_column;
+
+    unsigned long long max_blocked = 0;
+    for (long z = 0; z < zones; ++z) {
+        unsigned long long blocked = __atomic_load_n(&zone_contention[z].blocked_ns,
+                                                     __ATOMIC_RELAXED);
+        max_blocked = blocked > max_blocked ? blocked : max_blocked;
+    }
+
+    FILE *csv = openContentionFile(".csv");
+    FILE *pgm = openContentionFile(".pgm");
+    if (csv != NULL) {
+        fprintf(csv, "zone_row,zone_column,first_row,first_column,waits,blocked_us\n");
+    }
+    if (pgm != NULL) {
+        fprintf(pgm, "P2\n%d %d\n255\n", zones_in_row, zones_in_column);
+    }
+    for (int r = 0; r < zones_in_column; ++r) {
+        for (int c = 0; c < zones_in_row; ++c) {
+            struct ZoneContention *zone = zone_contention + (long)r * zones_in_row + c;
+            unsigned long long waits = __atomic_load_n(&zone->waits, __ATOMIC_RELAXED);
+            unsigned long long blocked = __atomic_load_n(&zone->blocked_ns, __ATOMIC_RELAXED);
+            if (csv != NULL) {
+                fprintf(csv, "%d,%d,%d,%d,%llu,%llu\n", r, c, r * zone_rows, c * zone_columns,
+                        waits, blocked / 1000);
+            }
+            if (pgm != NULL) {
+                fprintf(pgm, "%d%c", max_blocked > 0 ? (int)(255 * blocked / max_blocked) : 0,
+                        c + 1 < zones_in_row ? ' ' : '\n');
+            }
+        }
+    }
+    if (csv != NULL) {
+        fclose(csv);
+    }
+    if (pgm != NULL) {
+        fclose(pgm);
+    }
+
+    FILE *gardeners = openContentionFile("-gardeners.csv");
+    if (gardeners != NULL) {
+        fprintf(gardeners, "waiter,holder,waits\n");
+        for (int waiter = 0; waiter < CONTENTION_GARDENERS; ++waiter) {
+            for (int holder = 0; holder < CONTENTION_GARDENERS; ++holder) {
+                unsigned long long waits = __atomic_load_n(&contention->waits_for[waiter][holder],
+                                                           __ATOMIC_RELAXED);
+                if (waits > 0) {
+                    fprintf(gardeners, "%d,%d,%llu\n", waiter, holder, waits);
+                }
+            }
+        }
+        fclose(gardeners);
+    }
+    printf("Contention profile written to %s.csv\n", contention_prefix);
+    fflush(stdout);
+}
+
+// Сигналы серверу. Обработчики только ставят флаг и будят главный поток: sem_post безопасен
+// в обработчике, а запись профиля и остановка (stdio, malloc) выполняются в главном потоке
+volatile sig_atomic_t stop_requested = 0;
+volatile sig_atomic_t profile_requested = 0;
+sem_t server_signal;
+sigset_t server_signals;
+
+void contention_handler(int signum) {
+    (void)signum;
+    profile_requested = 1;
+    sem_post(&server_signal);
+}
+
+void runContentionProfiler(const char *prefix, struct FieldSize field_size) {
+    long zones = (long)((field_size.rows + zone_rows - 1) / zone_rows) *
+                 ((field_size.columns + zone_columns - 1) / zone_columns);
+    contention = getContention(zones, zoneCount(field_size));
+    zone_contention = (struct ZoneContention *)(contention + 1);
+    zone_holders = (int *)(zone_contention + zones);
+    contention_prefix = prefix;
+    contention_field_size = field_size;
+
+    signal(SIGUSR1, contention_handler);
+}
+
 int server_socket;
 int observer_socket;
+
+// Процессы садовников в режиме fork и их отметки незаконченной записи. Процессы создает поток
+// приема, а завершившиеся забирает главный поток, поэтому список под мьютексом
+struct ChildProcess {
+    pid_t pid;
+    int *open_write;
+};
+
+struct ChildProcess *children = NULL;
 int children_counter = 0;
+int children_capacity = 0;
+pthread_mutex_t children_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void addChildProcess(pid_t pid, int *open_write) {
+    pthread_mutex_lock(&children_lock);
+    if (children_counter == children_capacity) {
+        children_capacity = children_capacity > 0 ? children_capacity * 2 : 16;
+        children = realloc(children, children_capacity * sizeof(struct ChildProcess));
+    }
+    children[children_counter].pid = pid;
+    children[children_counter].open_write = open_write;
+    children_counter++;
+    pthread_mutex_unlock(&children_lock);
+}
+
+// Процесс садовника завершился. Если его убили (SIGKILL) посреди записи клетки, begun участка
+// уже никогда не догонит ended, и читающие ждали бы его вечно, поэтому сервер доводит запись
+// за процесс. Процесс, убитый ровно между сложением begun и установкой отметки, так не
+// найти: в этом окне в одну инструкцию участок останется недоступен для копий
+void releaseChild(pid_t pid) {
+    pthread_mutex_lock(&children_lock);
+    for (int k = 0; k < children_counter; ++k) {
+        if (children[k].pid != pid) {
+            continue;
+        }
+        int open_tile = __atomic_load_n(children[k].open_write, __ATOMIC_SEQ_CST);
+        if (open_tile > 0) {
+            endTileWrite(tile_versions + open_tile - 1);
+            countMetric(&metrics->repaired_writes, 1);
+        }
+        munmap(children[k].open_write, sizeof(int));
+        children[k] = children[--children_counter];
+        break;
+    }
+    pthread_mutex_unlock(&children_lock);
+}
+
+// Забирает завершившиеся процессы садовников, не дожидаясь остальных
+void reapChildProcesses() {
+    pid_t child_id;
+    while ((child_id = waitpid((pid_t)-1, NULL, WNOHANG)) > 0) {
+        releaseChild(child_id);
+    }
+}
 
 void waitChildProcessess() {
     while (children_counter > 0) {
@@ -489,7 +2966,7 @@ void waitChildProcessess() {
             perror("Unable to wait child proccess");
             exit(-1);
         } else {
-            children_counter--;
+            releaseChild(child_id);
         }
     }
 }
@@ -497,20 +2974,59 @@ void waitChildProcessess() {
 int personal_client_socket;
 
 void sigint_handler(int signum) {
+    (void)signum;
+    stop_requested = 1;
+    sem_post(&server_signal);
+}
+
+volatile sig_atomic_t children_exited = 0;
+
+void sigchld_handler(int signum) {
+    (void)signum;
+    children_exited = 1;
+    sem_post(&server_signal);
+}
+
+// Остановка сервера в главном потоке. Сначала прекращается прием садовников, затем writer
+// дочитывает кольцо до события STOP и завершается, и только после этого пишутся профиль
+// конкуренции и остаток журнала: их больше никто не трогает
+void stopServer() {
+    pthread_cancel(acceptor_thread);
+    pthread_join(acceptor_thread, NULL);
     waitChildProcessess();
     pthread_cancel(registartor_thread);
-    pthread_cancel(writer_thread);
-    struct Observer *observers_mem = getObserversMemory();
-    for (int i = 0; i < 100; ++i) {
-        int status = 0;
-        if (observers_mem[i].is_active == 1) {
-            send(observers_mem[i].socket, &status, sizeof(int), MSG_NOSIGNAL);
-            close(observers_mem[i].socket);
-        }
+    pthread_cancel(fanout_thread);
+    if (metrics_socket >= 0) {
+        pthread_cancel(metrics_thread);
+        close(metrics_socket);
+    }
+
+    struct Event stop_event;
+    setEventWithCurrentTime(&stop_event);
+    stop_event.type = STOP;
+    writeEvent(&stop_event);
+    pthread_join(writer_thread, NULL);
+
+    if (contention != NULL) {
+        writeContentionProfile();
+    }
+    if (journal_fd >= 0) {
+        flushJournal();
+        close(journal_fd);
+    }
+    for (int k = 0; k < registry.active_count; ++k) {
+        close(registry.slots[registry.active[k]].socket);
     }
     shm_unlink(shared_object);
+    shm_unlink(state_shared_object);
+    shm_unlink(occupants_shared_object);
+    shm_unlink(clock_shared_object);
+    shm_unlink(bitmaps_shared_object);
+    shm_unlink(events_shared_object);
+    shm_unlink(metrics_shared_object);
+    shm_unlink(contention_shared_object);
+    shm_unlink(versions_shared_object);
     shm_unlink(sem_shared_object);
-    shm_unlink(observers_shared_object);
     close(server_socket);
     close(observer_socket);
     printf("Server stopped\n");
@@ -518,15 +3034,278 @@ void sigint_handler(int signum) {
 }
 
 void child_sigint_handler(int signum) {
+    (void)signum;
+    if (tile_writing) {
+        exit_requested = 1;
+        return;
+    }
     close(personal_client_socket);
     exit(0);
 }
 
-int main(int argc, char *argv[]) {
+// Принятое соединение в очереди пула
+struct PendingConnection {
+    int socket;
+    struct timespec accepted_at;
+};
+
+// Очередь принятых соединений, общая для потоков пула
+struct WorkerPool {
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    struct PendingConnection queue[POOL_QUEUE];
+    int head;
+    int count;
+    sem_t *semaphores;
+    int *field;
+    struct FieldSize field_size;
+};
+
+struct PoolWorkerArgs {
+    struct WorkerPool *pool;
+    int core;
+};
+
+void *runPoolWorker(void *args) {
+    struct PoolWorkerArgs worker = *((struct PoolWorkerArgs *)args);
+    struct WorkerPool *pool = worker.pool;
+    free(args);
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(worker.core, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+        fprintf(stderr, "Unable to pin pool worker to core %d\n", worker.core);
+    }
+
+    while (1) {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->count == 0) {
+            pthread_cond_wait(&pool->not_empty, &pool->mutex);
+        }
+        struct PendingConnection connection = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % POOL_QUEUE;
+        pool->count--;
+        pthread_cond_signal(&pool->not_full);
+        pthread_mutex_unlock(&pool->mutex);
+
+        handle(connection.socket, pool->semaphores, pool->field, pool->field_size,
+               connection.accepted_at);
+    }
+}
+
+// Пул из threads заранее запущенных потоков, закрепленных за ядрами по кругу.
+// Каждый поток забирает принятые соединения из общей очереди и обслуживает их целиком
+void runWorkerPool(int server_socket, sem_t *semaphores, int *field, struct FieldSize field_size,
+                   int threads) {
+    struct WorkerPool *pool = malloc(sizeof(struct WorkerPool));
+    if (pool == NULL) {
+        perror("Unable to allocate worker pool");
+        exit(-1);
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->not_empty, NULL);
+    pthread_cond_init(&pool->not_full, NULL);
+    pool->head = 0;
+    pool->count = 0;
+    pool->semaphores = semaphores;
+    pool->field = field;
+    pool->field_size = field_size;
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < threads; ++i) {
+        struct PoolWorkerArgs *args = malloc(sizeof(struct PoolWorkerArgs));
+        args->pool = pool;
+        args->core = cores > 0 ? i % cores : 0;
+
+        pthread_t worker;
+        if (pthread_create(&worker, NULL, runPoolWorker, (void *)args) != 0) {
+            perror("Unable to create pool worker");
+            exit(-1);
+        }
+        pthread_detach(worker);
+    }
+
+    while (1) {
+        struct PendingConnection connection;
+        connection.socket = acceptClientConnection(server_socket, S_INFO);
+        clock_gettime(CLOCK_MONOTONIC, &connection.accepted_at);
+
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->count == POOL_QUEUE) {
+            pthread_cond_wait(&pool->not_full, &pool->mutex);
+        }
+        pool->queue[(pool->head + pool->count) % POOL_QUEUE] = connection;
+        pool->count++;
+        pthread_cond_signal(&pool->not_empty);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+// Размер поля задается либо стороной N (поле 2N x 2N, как раньше), либо как ROWSxCOLUMNS
+int parseFieldSize(const char *arg, struct FieldSize *field_size) {
+    if (strchr(arg, 'x') != NULL) {
+        if (sscanf(arg, "%dx%d", &field_size->rows, &field_size->columns) != 2) {
+            return -1;
+        }
+    } else {
+        field_size->rows = 2 * atoi(arg);
+        field_size->columns = field_size->rows;
+    }
+
+    if (field_size->rows < 1 || field_size->columns < 1 ||
+        (long)field_size->rows * field_size->columns > INT_MAX) {
+        return -1;
+    }
+    return 0;
+}
+
+// Разбор необязательных параметров вида --name=value после обязательных аргументов
+int parseServerOptions(int argc, char *argv[], int first, struct ServerOptions *options) {
+    options->mode = FORK_MODE;
+    options->threads = 4;
+    options->observer_queue = 65536;
+    options->slow_policy = DROP_OLDEST_SLOW;
+    options->sync = SEMAPHORE_SYNC;
+    options->clock = REAL_CLOCK;
+    options->gardeners = 2;
+    options->seed = 1;
+    options->zone_rows = PLOTS;
+    options->zone_columns = PLOTS;
+    options->lock_stripes = 0;
+    options->metrics_port = 0;
+    options->contention = NULL;
+    options->journal = NULL;
+
+    for (int i = first; i < argc; ++i) {
+        if (strcmp(argv[i], "--mode=fork") == 0) {
+            options->mode = FORK_MODE;
+        } else if (strcmp(argv[i], "--mode=epoll") == 0) {
+            options->mode = EPOLL_MODE;
+        } else if (strcmp(argv[i], "--mode=pool") == 0) {
+            options->mode = POOL_MODE;
+        } else if (strcmp(argv[i], "--sync=sem") == 0) {
+            options->sync = SEMAPHORE_SYNC;
+        } else if (strcmp(argv[i], "--sync=cas") == 0) {
+            options->sync = CAS_SYNC;
+        } else if (strcmp(argv[i], "--clock=real") == 0) {
+            options->clock = REAL_CLOCK;
+        } else if (strcmp(argv[i], "--clock=virtual") == 0) {
+            options->clock = VIRTUAL_CLOCK;
+        } else if (strcmp(argv[i], "--slow-observer=drop") == 0) {
+            options->slow_policy = DROP_OLDEST_SLOW;
+        } else if (strcmp(argv[i], "--slow-observer=disconnect") == 0) {
+            options->slow_policy = DISCONNECT_SLOW;
+        } else if (strcmp(argv[i], "--slow-observer=snapshot") == 0) {
+            options->slow_policy = SNAPSHOT_SLOW;
+        } else if (strncmp(argv[i], "--observer-queue=", 17) == 0 &&
+                   (options->observer_queue = atoi(argv[i] + 17)) >= 2048) {
+            continue;
+        } else if (strncmp(argv[i], "--zone=", 7) == 0) {
+            if (sscanf(argv[i] + 7, "%dx%d", &options->zone_rows, &options->zone_columns) != 2) {
+                options->zone_columns = options->zone_rows;
+            }
+            if (options->zone_rows < 1 || options->zone_columns < 1) {
+                return -1;
+            }
+        } else if (strncmp(argv[i], "--lock-stripes=", 15) == 0 &&
+                   (options->lock_stripes = atoi(argv[i] + 15)) > 0) {
+            continue;
+        } else if (strncmp(argv[i], "--metrics-port=", 15) == 0 &&
+                   (options->metrics_port = atoi(argv[i] + 15)) > 0) {
+            continue;
+        } else if (strncmp(argv[i], "--contention=", 13) == 0 && argv[i][13] != '\0') {
+            options->contention = argv[i] + 13;
+        } else if (strncmp(argv[i], "--journal=", 10) == 0 && argv[i][10] != '\0') {
+            options->journal = argv[i] + 10;
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            options->seed = strtoul(argv[i] + 7, NULL, 10);
+        } else if (strncmp(argv[i], "--gardeners=", 12) == 0 &&
+                   (options->gardeners = atoi(argv[i] + 12)) > 0) {
+            continue;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0 &&
+                   (options->threads = atoi(argv[i] + 10)) > 0) {
+            continue;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Прием садовников: в режимах epoll и pool соединения раздаются потокам, иначе на каждого
+// садовника создается процесс
+struct AcceptorArgs {
+    sem_t *semaphores;
+    int *field;
+    struct FieldSize field_size;
+    enum server_mode mode;
+    int threads;
+};
 
-    if (argc != 5) {
+void *acceptGardeners(void *args) {
+    struct AcceptorArgs data = *((struct AcceptorArgs *)args);
+    if (data.mode == EPOLL_MODE) {
+        runEpollServer(server_socket, data.semaphores, data.field, data.field_size, data.threads);
+    } else if (data.mode == POOL_MODE) {
+        runWorkerPool(server_socket, data.semaphores, data.field, data.field_size, data.threads);
+    }
+
+    while (1) {
+        int client_socket = acceptClientConnection(server_socket, S_INFO);
+        struct timespec accepted_at;
+        clock_gettime(CLOCK_MONOTONIC, &accepted_at);
+
+        // Иначе дочерний процесс при выходе повторно выведет унаследованный буфер stdout
+        fflush(stdout);
+
+        int *open_write = mmap(0, sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                               -1, 0);
+        if (open_write == MAP_FAILED) {
+            perror("Unable to map child write mark");
+            exit(-1);
+        }
+        *open_write = 0;
+
+        pid_t child_id;
+        if ((child_id = fork()) < 0) {
+            perror("Unable to create child proccess for new connection");
+            exit(-1);
+        } else if (child_id == 0) {
+            personal_client_socket = client_socket;
+            open_tile_write = open_write;
+            signal(SIGINT, child_sigint_handler);
+            pthread_sigmask(SIG_UNBLOCK, &server_signals, NULL);
+            close(server_socket);
+            handle(client_socket, data.semaphores, data.field, data.field_size, accepted_at);
+            exit(0);
+        }
+
+        printf("child process: %d\n", (int)child_id);
+        close(client_socket);
+        addChildProcess(child_id, open_write);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct ServerOptions options;
+    // SIGINT, SIGUSR1 и SIGCHLD принимает только главный поток: остальные потоки наследуют маску, и их
+    // блокирующие вызовы не прерываются сигналами
+    sem_init(&server_signal, 0, 0);
+    sigemptyset(&server_signals);
+    sigaddset(&server_signals, SIGINT);
+    sigaddset(&server_signals, SIGUSR1);
+    sigaddset(&server_signals, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &server_signals, NULL);
+
+    if (argc < 5 || parseServerOptions(argc, argv, 5, &options) < 0) {
         fprintf(stderr,
-                "Arguments:  %s <server IP> <server port> <observer port> <grid side size>\n",
+                "Arguments:  %s <server IP> <server port> <observer port> <grid side size | RxC> "
+                "[--mode=fork|epoll|pool] [--threads=N] [--sync=sem|cas] [--observer-queue=BYTES] "
+                "[--slow-observer=drop|disconnect|snapshot] [--clock=real|virtual] "
+                "[--gardeners=N] [--seed=N] [--zone=N | --zone=HxW] [--lock-stripes=N] "
+                "[--metrics-port=PORT] [--contention=PREFIX] [--journal=PATH]\n",
                 argv[0]);
         exit(1);
     }
@@ -549,73 +3328,120 @@ int main(int argc, char *argv[]) {
         exit(-1);
     }
 
-    if (pipe(pipe_fd) < 0) {
-        perror("Can't open pipe");
-        exit(-1);
-    }
+    server_started_at = monotonicNanoseconds();
+    event_ring = getEventRing();
+    metrics = getMetrics();
 
-    int square_side_size = atoi(argv[4]);
-    if (square_side_size > 10 || square_side_size < 2) {
-        perror("Square side size should be in range [2, 10]");
+    struct FieldSize field_size;
+    if (parseFieldSize(argv[4], &field_size) < 0) {
+        fprintf(stderr, "Grid size should be a side size N (2N x 2N plots) or ROWSxCOLUMNS\n");
         exit(-1);
     }
-
-    int rows = 2 * square_side_size;
-    int columns = 2 * square_side_size;
-
-    // +1 под семафор для observers
-    int sem_count = rows * columns / 4 + 1;
-
-    int *field = getField(rows * columns);
+    int rows = field_size.rows;
+    int columns = field_size.columns;
+
+    // Семафоры зон, затем семафор для observers и семафор вывода карты
+    zone_rows = options.zone_rows;
+    zone_columns = options.zone_columns;
+    lock_stripes = options.lock_stripes;
+    int sem_count = zoneCount(field_size) + 2;
+
+    // Одинаковое зерно дает одинаковое расположение необрабатываемых клеток
+    srandom(options.seed);
+    int *field = getField((size_t)rows * columns);
     initializeField(field, rows, columns);
+    tile_versions = getTileVersions(((long)rows * columns + TILE_CELLS - 1) / TILE_CELLS);
+
+    // Битовые карты необработанных клеток по строкам и по столбцам
+    row_words = (columns + 63) / 64;
+    column_words = (rows + 63) / 64;
+    row_bitmaps = getBitmaps((size_t)rows * row_words + (size_t)columns * column_words);
+    column_bitmaps = row_bitmaps + (size_t)rows * row_words;
+    setUnprocessedBits(field, field_size);
 
     sem_t *semaphores = createSemaphoresSharedMemory(sem_count);
     createSemaphores(semaphores, sem_count);
 
-    observers = getObserversMemory();
+    // Каждый наблюдатель занимает дескриптор, тысячи наблюдателей не помещаются в обычный лимит
+    struct rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+    shared_state = getSharedState();
+    shared_state->sequence = 0;
+    shared_state->generation = 0;
+    shared_state->watchers = 0;
+    shared_state->rows = rows;
+    shared_state->columns = columns;
+
+    // Слова занятости клеток нужны только в режиме CAS; ftruncate заполняет их нулями
+    sync_mode = options.sync;
+    if (sync_mode == CAS_SYNC) {
+        occupants = getOccupants((size_t)rows * columns);
+    }
+
+    // Садовник в виртуальном времени блокирует обслуживающий его процесс, поэтому режим
+    // работает только с отдельным процессом на садовника
+    if (options.clock == VIRTUAL_CLOCK) {
+        if (options.mode != FORK_MODE || options.sync != SEMAPHORE_SYNC) {
+            fprintf(stderr, "Virtual clock requires --mode=fork and --sync=sem\n");
+            exit(1);
+        }
+        virtual_clock = getVirtualClock(zoneCount(field_size), options.gardeners);
+    }
+
+    if (options.contention != NULL) {
+        runContentionProfiler(options.contention, field_size);
+    }
+    if (options.journal != NULL) {
+        openJournal(options.journal, field, field_size);
+    }
 
     server_socket = createServerSocket(server_address, server_port);
     observer_socket = createServerSocket(server_address, observer_port);
 
-    runWriter(semaphores + sem_count - 1);
-
     struct Args args;
     args.socket = observer_socket;
-    args.sem = semaphores + sem_count - 1;
+    args.sem = semaphores + sem_count - 2;
+    args.field = field;
+    args.field_size = field_size;
+    args.queue_capacity = options.observer_queue;
+    args.policy = options.slow_policy;
+    runWriter(&args);
     runObserverRegistrator(&args);
+    if (options.metrics_port > 0) {
+        runMetricsServer(server_address, options.metrics_port);
+    }
 
     signal(SIGINT, sigint_handler);
-
-    struct Event event;
-    setEventWithCurrentTime(&event);
-    sprintf(event.buffer, "\n");
-    sprintField(event.buffer + 1, field, columns, columns);
-    event.type = MAP;
-    writeEventToPipe(&event);
-
-    while (1) {
-        int client_socket = acceptClientConnection(server_socket);
-
-        pid_t child_id;
-        if ((child_id = fork()) < 0) {
-            perror("Unable to create child proccess for new connection");
-            exit(-1);
-        } else if (child_id == 0) {
-            struct FieldSize field_size;
-            field_size.columns = columns;
-            field_size.rows = rows;
-
-            personal_client_socket = client_socket;
-            signal(SIGINT, child_sigint_handler);
-            close(server_socket);
-            handle(client_socket, semaphores, field, field_size);
-            exit(0);
+    signal(SIGCHLD, sigchld_handler);
+
+    writeFieldEvents(semaphores + sem_count - 1, field, field_size);
+
+    struct AcceptorArgs acceptor;
+    acceptor.semaphores = semaphores;
+    acceptor.field = field;
+    acceptor.field_size = field_size;
+    acceptor.mode = options.mode;
+    acceptor.threads = options.threads;
+    pthread_create(&acceptor_thread, NULL, acceptGardeners, (void *)&acceptor);
+
+    // Главный поток только обслуживает сигналы
+    pthread_sigmask(SIG_UNBLOCK, &server_signals, NULL);
+    while (!stop_requested) {
+        if (sem_wait(&server_signal) != 0) {
+            continue;
+        }
+        if (children_exited) {
+            children_exited = 0;
+            reapChildProcesses();
+        }
+        if (profile_requested && contention != NULL) {
+            profile_requested = 0;
+            writeContentionProfile();
         }
-
-        printf("child process: %d\n", (int)child_id);
-        close(client_socket);
-        children_counter++;
     }
-
+    stopServer();
     return 0;
 }
@@ -0,0 +1,44 @@
+#ifndef TILE_VERSIONS_H
+#define TILE_VERSIONS_H
+
+#include <sched.h>
+
+// Версии участков поля, общие для сервера и локального наблюдателя (observer --local).
+// Участок - TILE_CELLS клеток подряд (построчно). Пишущий увеличивает begun до изменения клетки
+// и ended после. В режиме CAS клетки одного участка меняют одновременно несколько садовников,
+// поэтому счетчиков два, а не один нечетный номер, как в обычном seqlock
+#define TILE_CELLS 256
+// После стольких неудачных попыток копии участка читающий уступает процессор
+#define TILE_SPIN_LIMIT 64
+
+struct TileVersion {
+    unsigned int begun;
+    unsigned int ended;
+};
+
+// Согласованная копия count клеток одного участка: участок копируется, если до копии begun
+// совпадал с ended (никто не пишет), а после копии begun не изменился. После TILE_SPIN_LIMIT
+// попыток читающий уступает процессор, чтобы писатель на том же ядре успел закончить.
+// Незаконченную запись умершего процесса садовника доводит за него сервер (releaseChild),
+// поэтому ожидание не бесконечно. Возвращает 1, если копию пришлось повторять
+static inline int copyTile(int *to, const int *cells, const struct TileVersion *tile, long count) {
+    int attempts = 0;
+    while (1) {
+        unsigned int ended = __atomic_load_n(&tile->ended, __ATOMIC_ACQUIRE);
+        unsigned int begun = __atomic_load_n(&tile->begun, __ATOMIC_ACQUIRE);
+        if (begun == ended) {
+            for (long k = 0; k < count; ++k) {
+                to[k] = __atomic_load_n(cells + k, __ATOMIC_RELAXED);
+            }
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&tile->begun, __ATOMIC_RELAXED) == begun) {
+                return attempts > 0;
+            }
+        }
+        if (++attempts >= TILE_SPIN_LIMIT) {
+            sched_yield();
+        }
+    }
+}
+
+#endif
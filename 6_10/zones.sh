@@ -0,0 +1,28 @@
+if [[ $# -lt 3 ]] ;
+then
+    echo "You should pass at least 3 args: port, observer port, grid side size [bench options]"
+    exit 1
+fi
+
+# Сравнение размеров зон: мелкие зоны - больше семафоров, но садовники реже ждут друг друга,
+# крупные - меньше семафоров и больше ожиданий. Таблица из STRIPES блокировок ограничивает
+# память на семафоры для больших полей. Каждый запуск использует свою пару портов.
+port=$1
+observer_port=$2
+
+run() {
+    ./bench $port $observer_port $grid "${bench_options[@]}" -- "$@"
+    port=$((port + 2))
+    observer_port=$((observer_port + 2))
+}
+
+grid=$3
+bench_options=("${@:4}")
+for zone in ${ZONES:-1x1 2x2 4x4 8x8 16x16} ; do
+    echo -n "zone=$zone "
+    run --zone=$zone
+done
+for stripes in ${STRIPES:-16 256} ; do
+    echo -n "zone=2x2 stripes=$stripes "
+    run --lock-stripes=$stripes
+done